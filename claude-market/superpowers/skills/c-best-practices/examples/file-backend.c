@@ -0,0 +1,550 @@
+// examples/file-backend.c
+// Example storage backend driving a regular file or block device through
+// the kernel's asynchronous kiocb interface (the same path io_uring uses)
+// Shows a complete storage_ops table, batched submission, async completion
+// and IOCB_HIPRI completion polling
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/uio.h>
+#include <linux/file.h>
+#include <linux/falloc.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/errno.h>
+
+#include "module-interface.h"
+
+#define FILE_BACKEND_NAME         "file"
+#define FILE_BACKEND_MAX_TRANSFER (1024 * 1024)   // 1MB per backend I/O
+#define FILE_BACKEND_QUEUE_DEPTH  1024            // In-flight kiocbs per device
+
+static char *path;
+module_param(path, charp, 0444);
+MODULE_PARM_DESC(path, "File or block device backing the storage device");
+
+/**
+ * Per-device backend state
+ * The file is opened once at probe and held for the device lifetime,
+ * so the I/O path never resolves a path or takes a file reference
+ */
+struct file_backend {
+    struct file *filp;
+    loff_t size;
+    bool direct;               // O_DIRECT accepted by the file
+    bool is_reg;               // Regular file: writes take freeze protection
+    bool iopoll;               // File supports IOCB_HIPRI completion polling
+    u32 block_size;            // Logical block size for alignment
+    struct kmem_cache *iocb_cache;
+};
+
+/**
+ * Per-hardware-queue state, hung off hwq->private_data
+ * Polled kiocbs are queued on the hardware queue they were dispatched
+ * on, so polling one queue only reaps that queue's requests
+ */
+struct file_hwq {
+    spinlock_t poll_lock;
+    struct list_head poll_list;    // Queued IOCB_HIPRI kiocbs
+};
+
+/**
+ * One in-flight asynchronous I/O
+ */
+struct file_iocb {
+    struct kiocb iocb;
+    struct iov_iter iter;
+    struct kvec kvec;          // Used for single-buffer requests
+    struct storage_request *req;
+
+    // Polled I/O: completion only records the result for file_poll()
+    struct list_head poll_node;
+    long res;
+    bool polled;
+    bool done;
+};
+
+/*
+ * struct storage_segment is layout-compatible with struct kvec, so segment
+ * arrays are handed to iov_iter_kvec() as-is instead of being copied
+ */
+static_assert(sizeof(struct storage_segment) == sizeof(struct kvec));
+static_assert(offsetof(struct storage_segment, base) == offsetof(struct kvec, iov_base));
+static_assert(offsetof(struct storage_segment, len) == offsetof(struct kvec, iov_len));
+
+static struct file_backend *to_backend(struct storage_context *ctx) {
+    return ctx->device->private_data;
+}
+
+/**
+ * Validate an I/O range against the backing file
+ * Returns 0 if valid, negative error otherwise
+ */
+static int file_check_range(struct file_backend *fb, u64 offset, size_t len) {
+    if (len == 0 || len > FILE_BACKEND_MAX_TRANSFER) {
+        return -EINVAL;
+    }
+
+    // Overflow-safe bounds check
+    if (offset > fb->size || len > fb->size - offset) {
+        return -ERANGE;
+    }
+
+    if (fb->direct && ((offset | len) & (fb->block_size - 1))) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int file_probe(struct storage_device *dev) {
+    struct file_backend *fb;
+    struct inode *inode;
+    int ret;
+
+    if (!path) {
+        pr_err("%s: no backing path given\n", FILE_BACKEND_NAME);
+        return -EINVAL;
+    }
+
+    fb = kzalloc(sizeof(*fb), GFP_KERNEL);
+    if (!fb) {
+        return -ENOMEM;
+    }
+
+    // Prefer direct I/O so the page cache is not duplicated under ours
+    fb->filp = filp_open(path, O_RDWR | O_LARGEFILE | O_DIRECT, 0);
+    if (IS_ERR(fb->filp)) {
+        fb->filp = filp_open(path, O_RDWR | O_LARGEFILE, 0);
+    } else {
+        fb->direct = true;
+    }
+    if (IS_ERR(fb->filp)) {
+        ret = PTR_ERR(fb->filp);
+        pr_err("%s: cannot open %s: %d\n", FILE_BACKEND_NAME, path, ret);
+        goto err_free;
+    }
+
+    inode = file_inode(fb->filp);
+    fb->is_reg = S_ISREG(inode->i_mode);
+    fb->iopoll = fb->direct && fb->filp->f_op->iopoll;
+    if (S_ISBLK(inode->i_mode)) {
+        fb->size = bdev_nr_bytes(I_BDEV(inode));
+        fb->block_size = bdev_logical_block_size(I_BDEV(inode));
+    } else if (S_ISREG(inode->i_mode)) {
+        fb->size = i_size_read(inode);
+        fb->block_size = i_blocksize(inode);
+    } else {
+        ret = -EINVAL;
+        goto err_close;
+    }
+
+    fb->iocb_cache = KMEM_CACHE(file_iocb, 0);
+    if (!fb->iocb_cache) {
+        ret = -ENOMEM;
+        goto err_close;
+    }
+
+    dev->private_data = fb;
+    pr_info("%s: %s, %lld bytes, %s I/O\n", FILE_BACKEND_NAME, path,
+            fb->size, fb->direct ? "direct" : "buffered");
+    return 0;
+
+err_close:
+    filp_close(fb->filp, NULL);
+err_free:
+    kfree(fb);
+    return ret;
+}
+
+static int file_remove(struct storage_device *dev) {
+    struct file_backend *fb = dev->private_data;
+
+    if (!fb) {
+        return 0;
+    }
+
+    // Core guarantees no I/O is in flight once remove is called
+    kmem_cache_destroy(fb->iocb_cache);
+    filp_close(fb->filp, NULL);
+    kfree(fb);
+    dev->private_data = NULL;
+    return 0;
+}
+
+static int file_read(struct storage_context *ctx, u64 offset,
+                     void *buf, size_t len, u32 flags) {
+    struct file_backend *fb = to_backend(ctx);
+    loff_t pos = offset;
+    int ret;
+
+    ret = file_check_range(fb, offset, len);
+    if (ret) {
+        return ret;
+    }
+
+    return kernel_read(fb->filp, buf, len, &pos);
+}
+
+static int file_write(struct storage_context *ctx, u64 offset,
+                      const void *buf, size_t len, u32 flags) {
+    struct file_backend *fb = to_backend(ctx);
+    loff_t pos = offset;
+    ssize_t written;
+    int ret;
+
+    ret = file_check_range(fb, offset, len);
+    if (ret) {
+        return ret;
+    }
+
+    written = kernel_write(fb->filp, buf, len, &pos);
+    if (written < 0) {
+        return written;
+    }
+
+    if (flags & STORAGE_OP_FUA) {
+        ret = vfs_fsync_range(fb->filp, offset, offset + len - 1, 1);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return written;
+}
+
+static int file_flush(struct storage_context *ctx, u32 flags) {
+    return vfs_fsync(to_backend(ctx)->filp, 0);
+}
+
+static int file_trim(struct storage_context *ctx, u64 offset, size_t len) {
+    struct file_backend *fb = to_backend(ctx);
+    int ret;
+
+    ret = file_check_range(fb, offset, len);
+    if (ret) {
+        return ret;
+    }
+
+    // Punching a hole releases blocks on files and issues discard on bdevs
+    return vfs_fallocate(fb->filp, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                         offset, len);
+}
+
+/**
+ * Finish one kiocb: drop write freeze protection, free it and complete
+ * the request
+ */
+static void file_end_io(struct file_iocb *fio, long ret) {
+    struct storage_request *req = fio->req;
+    struct file_backend *fb = to_backend(req->ctx);
+
+    // Only regular files took freeze protection in file_submit()
+    if ((fio->iocb.ki_flags & IOCB_WRITE) && fb->is_reg) {
+        kiocb_end_write(&fio->iocb);
+    }
+
+    kmem_cache_free(fb->iocb_cache, fio);
+    storage_request_complete(req, ret < 0 ? (int)ret : 0,
+                             ret < 0 ? 0 : (size_t)ret);
+}
+
+/**
+ * kiocb completion, called from the filesystem or block layer
+ * May run in interrupt context, or inside ->iopoll for polled kiocbs,
+ * which are left for file_poll() to reap
+ */
+static void file_aio_complete(struct kiocb *iocb, long ret) {
+    struct file_iocb *fio = container_of(iocb, struct file_iocb, iocb);
+
+    if (fio->polled) {
+        fio->res = ret;
+        smp_store_release(&fio->done, true);
+        return;
+    }
+
+    file_end_io(fio, ret);
+}
+
+/**
+ * Build and issue one asynchronous kiocb
+ * Returns 0 once the request is owned by the file, negative error otherwise
+ */
+static int file_submit(struct storage_context *ctx, struct storage_request *req,
+                       const struct storage_segment *segs, unsigned int nr_segs,
+                       size_t len) {
+    struct file_backend *fb = to_backend(ctx);
+    bool write = req->type == STORAGE_REQ_WRITE;
+    struct file_iocb *fio;
+    ssize_t ret;
+
+    // Batches may carry flush and trim requests; neither has a buffer
+    switch (req->type) {
+    case STORAGE_REQ_FLUSH:
+        ret = file_flush(ctx, req->flags);
+        storage_request_complete(req, ret, 0);
+        return 0;
+    case STORAGE_REQ_TRIM:
+        ret = file_trim(ctx, req->offset, req->length);
+        storage_request_complete(req, ret, ret ? 0 : req->length);
+        return 0;
+    default:
+        break;
+    }
+
+    ret = file_check_range(fb, req->offset, len);
+    if (ret) {
+        return ret;
+    }
+
+    fio = kmem_cache_alloc(fb->iocb_cache, GFP_NOIO);
+    if (!fio) {
+        return -ENOMEM;
+    }
+
+    fio->req = req;
+    fio->polled = fb->iopoll && (ctx->flags & STORAGE_CTX_POLLED);
+    fio->done = false;
+
+    init_sync_kiocb(&fio->iocb, fb->filp);
+    fio->iocb.ki_pos = req->offset;
+    fio->iocb.ki_complete = file_aio_complete;
+    if (fb->direct) {
+        fio->iocb.ki_flags |= IOCB_DIRECT;
+    }
+    if (fio->polled) {
+        fio->iocb.ki_flags |= IOCB_HIPRI;
+    }
+    if (write) {
+        // Same freeze protection aio and io_uring take for async writes
+        if (fb->is_reg) {
+            kiocb_start_write(&fio->iocb);
+        }
+        fio->iocb.ki_flags |= IOCB_WRITE;
+        if (req->flags & STORAGE_OP_FUA) {
+            fio->iocb.ki_flags |= IOCB_DSYNC;
+        }
+    }
+
+    if (nr_segs) {
+        iov_iter_kvec(&fio->iter, write ? ITER_SOURCE : ITER_DEST,
+                      (const struct kvec *)segs, nr_segs, len);
+    } else {
+        fio->kvec.iov_base = req->buffer;
+        fio->kvec.iov_len = len;
+        iov_iter_kvec(&fio->iter, write ? ITER_SOURCE : ITER_DEST,
+                      &fio->kvec, 1, len);
+    }
+
+    if (write) {
+        ret = vfs_iocb_iter_write(fb->filp, &fio->iocb, &fio->iter);
+    } else {
+        ret = vfs_iocb_iter_read(fb->filp, &fio->iocb, &fio->iter);
+    }
+
+    // Buffered I/O and cache hits finish inline instead of queueing
+    if (ret != -EIOCBQUEUED) {
+        file_end_io(fio, ret);
+        return 0;
+    }
+
+    if (fio->polled) {
+        struct file_hwq *fq = storage_request_hw_queue(ctx, req)->private_data;
+
+        spin_lock(&fq->poll_lock);
+        list_add_tail(&fio->poll_node, &fq->poll_list);
+        spin_unlock(&fq->poll_lock);
+    }
+
+    return 0;
+}
+
+/*
+ * The core has already filled in req (ctx, type, offset, length, buffer
+ * or segments, flags); the entry points only pick the data layout
+ */
+static int file_read_async(struct storage_context *ctx, u64 offset,
+                           void *buf, size_t len, u32 flags,
+                           struct storage_request *req) {
+    return file_submit(ctx, req, NULL, 0, len);
+}
+
+static int file_write_async(struct storage_context *ctx, u64 offset,
+                            const void *buf, size_t len, u32 flags,
+                            struct storage_request *req) {
+    return file_submit(ctx, req, NULL, 0, len);
+}
+
+static int file_readv_async(struct storage_context *ctx, u64 offset,
+                            const struct storage_segment *segs,
+                            unsigned int nr_segs, u32 flags,
+                            struct storage_request *req) {
+    return file_submit(ctx, req, segs, nr_segs, req->length);
+}
+
+static int file_writev_async(struct storage_context *ctx, u64 offset,
+                             const struct storage_segment *segs,
+                             unsigned int nr_segs, u32 flags,
+                             struct storage_request *req) {
+    return file_submit(ctx, req, segs, nr_segs, req->length);
+}
+
+static int file_init_hw_queue(struct storage_context *ctx,
+                              struct storage_hw_queue *hwq) {
+    struct file_hwq *fq;
+
+    fq = kzalloc(sizeof(*fq), GFP_KERNEL);
+    if (!fq) {
+        return -ENOMEM;
+    }
+
+    spin_lock_init(&fq->poll_lock);
+    INIT_LIST_HEAD(&fq->poll_list);
+    hwq->private_data = fq;
+    return 0;
+}
+
+static void file_exit_hw_queue(struct storage_context *ctx,
+                               struct storage_hw_queue *hwq) {
+    // Core drains the queue before tearing it down
+    kfree(hwq->private_data);
+    hwq->private_data = NULL;
+}
+
+/**
+ * Reap polled kiocbs of one hardware queue
+ * Drives ->iopoll on every kiocb queued on @hwq, then completes up to
+ * @max that have finished. The list is detached while polling because
+ * completion of other requests may submit new ones.
+ * Returns the number of requests completed
+ */
+static int file_poll(struct storage_context *ctx, struct storage_hw_queue *hwq,
+                     unsigned int max) {
+    struct file_backend *fb = to_backend(ctx);
+    struct file_hwq *fq = hwq->private_data;
+    struct file_iocb *fio, *tmp;
+    LIST_HEAD(list);
+    int reaped = 0;
+
+    spin_lock(&fq->poll_lock);
+    list_splice_init(&fq->poll_list, &list);
+    spin_unlock(&fq->poll_lock);
+
+    list_for_each_entry(fio, &list, poll_node) {
+        if (!READ_ONCE(fio->done)) {
+            fb->filp->f_op->iopoll(&fio->iocb, NULL, 0);
+        }
+    }
+
+    list_for_each_entry_safe(fio, tmp, &list, poll_node) {
+        if (reaped == max) {
+            break;
+        }
+        if (!smp_load_acquire(&fio->done)) {
+            continue;
+        }
+        list_del(&fio->poll_node);
+        file_end_io(fio, fio->res);
+        reaped++;
+    }
+
+    spin_lock(&fq->poll_lock);
+    list_splice(&list, &fq->poll_list);
+    spin_unlock(&fq->poll_lock);
+
+    return reaped;
+}
+
+/**
+ * Submit a plugged batch
+ * The block plug holds bios from every kiocb until the whole batch is
+ * built, so the device sees one merged submission per batch
+ */
+static int file_submit_batch(struct storage_context *ctx,
+                             struct storage_request **reqs, unsigned int nr) {
+    struct blk_plug plug;
+    unsigned int i;
+    int ret = 0;
+
+    blk_start_plug(&plug);
+    for (i = 0; i < nr; i++) {
+        struct storage_request *req = reqs[i];
+        int err;
+
+        if (req->nr_segs) {
+            err = file_submit(ctx, req, req->segs, req->nr_segs, req->length);
+        } else {
+            err = file_submit(ctx, req, NULL, 0, req->length);
+        }
+
+        // Complete failed requests here so each one still gets exactly one completion
+        if (err) {
+            storage_request_complete(req, err, 0);
+            if (!ret) {
+                ret = err;
+            }
+        }
+    }
+    blk_finish_plug(&plug);
+
+    return ret;
+}
+
+static int file_get_caps(struct storage_context *ctx, struct storage_caps *caps) {
+    struct file_backend *fb = to_backend(ctx);
+
+    memset(caps, 0, sizeof(*caps));
+    caps->version = STORAGE_MODULE_VERSION;
+    caps->features = STORAGE_FEATURE_ASYNC;
+    caps->max_device_size = fb->size;
+    caps->max_transfer_size = FILE_BACKEND_MAX_TRANSFER;
+    caps->min_io_size = fb->block_size;
+    caps->optimal_io_size = max_t(u32, fb->block_size, PAGE_SIZE);
+    caps->dma_alignment = fb->direct ? fb->block_size : 1;
+    caps->sector_size = fb->block_size;
+    caps->max_queue_depth = FILE_BACKEND_QUEUE_DEPTH;
+    caps->supports_trim = true;
+    caps->supports_discard = true;
+    return 0;
+}
+
+static const struct storage_ops file_backend_ops = {
+    .probe = file_probe,
+    .remove = file_remove,
+    .read = file_read,
+    .write = file_write,
+    .flush = file_flush,
+    .trim = file_trim,
+    .read_async = file_read_async,
+    .write_async = file_write_async,
+    .readv_async = file_readv_async,
+    .writev_async = file_writev_async,
+    .submit_batch = file_submit_batch,
+    .poll = file_poll,
+    .init_hw_queue = file_init_hw_queue,
+    .exit_hw_queue = file_exit_hw_queue,
+    .get_caps = file_get_caps,
+    .version = STORAGE_MODULE_VERSION,
+    .name = FILE_BACKEND_NAME,
+    .description = "File or block device backend using async kiocbs",
+    .author = "C Best Practices Skill",
+    .license = "GPL",
+};
+
+static int __init file_backend_init(void) {
+    return storage_register_backend(&file_backend_ops);
+}
+
+static void __exit file_backend_exit(void) {
+    storage_unregister_backend(&file_backend_ops);
+}
+
+module_init(file_backend_init);
+module_exit(file_backend_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("C Best Practices Skill");
+MODULE_DESCRIPTION("File-backed storage backend example with async kiocb I/O");
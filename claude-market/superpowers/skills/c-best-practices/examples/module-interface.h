@@ -14,11 +14,40 @@
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/hash.h>
+#include <linux/rbtree.h>
+#include <linux/workqueue.h>
+#include <linux/timer.h>
+#include <linux/rculist.h>
+#include <linux/xarray.h>
+#include <linux/percpu-refcount.h>
+#include <linux/completion.h>
+#include <linux/xxhash.h>
+#include <linux/crc32c.h>
+#include <linux/ktime.h>
+#include <linux/scatterlist.h>
+#include <crypto/skcipher.h>
 #include <linux/wait.h>
+#include <linux/sched.h>
 #include <linux/list.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
+#include <linux/local_lock.h>
+#include <linux/smp.h>
+#include <linux/slab.h>
+#include <linux/mempool.h>
+#include <linux/seqlock.h>
 
-/* Module version information - allows for backward compatibility */
-#define STORAGE_MODULE_VERSION        2
+/*
+ * Module version information - allows for backward compatibility
+ * v3: optional ops appended to struct storage_ops (vectored, protection
+ *     information, batching, polling, timeouts, multi-queue); v1/v2
+ *     members keep their offsets. struct storage_stats gained counters,
+ *     so stats consumers must be rebuilt against this header.
+ */
+#define STORAGE_MODULE_VERSION        3
 #define STORAGE_MODULE_MIN_VERSION    1
 #define STORAGE_MODULE_MAGIC         0x53544F52  /* "STOR" */
 
@@ -33,11 +62,160 @@
 #define STORAGE_OP_NOCACHE     (1 << 1)   /* Bypass cache */
 #define STORAGE_OP_FUA         (1 << 2)   /* Force Unit Access */
 #define STORAGE_OP_ZERO        (1 << 3)   /* Zero-fill on error */
+#define STORAGE_OP_INPLACE     (1 << 4)   /* Write buffer may be transformed in place */
+#define STORAGE_OP_NOPI        (1 << 5)   /* Skip protection information */
+
+/* Context flags (storage_context.flags) */
+#define STORAGE_CTX_NOMERGE    (1 << 0)   /* Dispatch requests unmerged */
+#define STORAGE_CTX_POLLED     (1 << 1)   /* Reap completions by polling */
+#define STORAGE_CTX_HYBRID     (1 << 2)   /* Sleep part of service time, then poll */
+
+/* Hybrid polling: sleep for mean service time / STORAGE_POLL_SLEEP_DIV */
+#define STORAGE_POLL_SLEEP_DIV 2
+#define STORAGE_POLL_EWMA_SHIFT 3         /* Mean weights new sample 1/8 */
+
+/* Vectored I/O limits */
+#define STORAGE_MAX_SEGMENTS   256        /* Segments per vectored request */
+
+/* Multi-queue submission limits */
+#define STORAGE_MAX_HW_QUEUES      64    /* Upper bound on dispatch queues */
+#define STORAGE_SW_QUEUE_BATCH     32    /* Requests drained per sw queue pass */
+#define STORAGE_PLUG_MAX_REQUESTS  256   /* Auto-unplug threshold */
+#define STORAGE_PLUG_SUBMIT_BATCH  32    /* Requests per ops->submit_batch call */
+#define STORAGE_COMPLETION_BATCH   64    /* Requests per completion batch */
+
+/*
+ * Latency histogram geometry (log-linear, HDR-style)
+ * Each power of two is split into 2^STORAGE_LAT_SUB_BITS linear buckets,
+ * giving ~6% relative error up to 2^STORAGE_LAT_MAX_SHIFT ns (~68 s).
+ */
+#define STORAGE_LAT_SUB_BITS       4
+#define STORAGE_LAT_MAX_SHIFT      36
+#define STORAGE_LAT_NR_BUCKETS \
+    ((STORAGE_LAT_MAX_SHIFT - STORAGE_LAT_SUB_BITS + 1) << STORAGE_LAT_SUB_BITS)
+#define STORAGE_LAT_NR_OPS         4     /* read, write, flush, trim */
+
+/* Block cache geometry */
+#define STORAGE_CACHE_SHARD_BITS   6     /* 64 shards */
+#define STORAGE_CACHE_NR_SHARDS    (1U << STORAGE_CACHE_SHARD_BITS)
+
+/* Readahead window bounds; the ceiling is storage_caps.max_transfer_size */
+#define STORAGE_RA_MIN_WINDOW      (16 * 1024)
+#define STORAGE_RA_TRIGGER_HITS    2     /* Matching accesses before readahead */
+
+/* Write-back defaults: background writeback starts at half the dirty limit */
+#define STORAGE_WB_DEFAULT_LIMIT   (64ULL * 1024 * 1024)
+#define STORAGE_WB_BACKGROUND_DIV  2
+#define STORAGE_WB_EXPIRE_MS       5000  /* Max age of dirty data */
+
+/* I/O scheduler defaults */
+#define STORAGE_SCHED_NAME_LEN         16
+#define STORAGE_DEADLINE_READ_EXPIRE   500   /* ms */
+#define STORAGE_DEADLINE_WRITE_EXPIRE  5000  /* ms */
+#define STORAGE_DEADLINE_WRITES_STARVED 2    /* Read batches before a write batch */
+#define STORAGE_DEADLINE_FIFO_BATCH    16
+#define STORAGE_WFQ_DEFAULT_WEIGHT     100   /* Per-context share, 1..1000 */
+
+/*
+ * Request timeout wheel: STORAGE_TW_LEVELS levels of 2^STORAGE_TW_SLOT_BITS
+ * slots with a 1ms tick cover 64ms, 4s, 4.3min and 4.6h per level
+ */
+#define STORAGE_TW_SLOT_BITS       6
+#define STORAGE_TW_SLOTS           (1U << STORAGE_TW_SLOT_BITS)
+#define STORAGE_TW_SLOT_MASK       (STORAGE_TW_SLOTS - 1)
+#define STORAGE_TW_LEVELS          4
+#define STORAGE_TW_TICK_MS         1
+#define STORAGE_TW_MAX_TICKS \
+    ((1ULL << (STORAGE_TW_SLOT_BITS * STORAGE_TW_LEVELS)) - 1)
+
+/*
+ * Compression layer
+ * Writes are compressed in fixed chunks; each chunk maps to one packed
+ * u64: physical sector (bits 0-47), stored length in sectors (48-62) and
+ * a raw flag (bit 63) for chunks kept uncompressed. The map itself is
+ * stored little-endian at the start of the backend, STORAGE_CMAP_BLOCK
+ * bytes at a time, so sector 0 is never a data sector.
+ */
+#define STORAGE_COMPRESS_CHUNK_SIZE    (64 * 1024)
+#define STORAGE_COMPRESS_SECTOR_SHIFT  9
+#define STORAGE_CMAP_SECTOR_MASK       ((1ULL << 48) - 1)
+#define STORAGE_CMAP_LEN_SHIFT         48
+#define STORAGE_CMAP_LEN_MASK          0x7FFFULL
+#define STORAGE_CMAP_RAW               (1ULL << 63)
+#define STORAGE_CMAP_UNMAPPED          0ULL
+#define STORAGE_COMPRESS_CHUNK_LOCKS   64    /* Hashed partial-chunk write locks */
+#define STORAGE_CMAP_BLOCK             4096  /* On-disk map write unit */
+#define STORAGE_CMAP_PER_BLOCK         (STORAGE_CMAP_BLOCK / sizeof(u64))
+#define STORAGE_COMPRESS_PROBE_SAMPLES 256   /* Bytes sampled by the probe */
+#define STORAGE_COMPRESS_PROBE_MAX     144   /* Uniform data averages ~162 */
+
+/* Encryption layer: AES-XTS, tweak = data unit number (dm-crypt plain64) */
+#define STORAGE_CRYPT_CIPHER          "xts(aes)"
+#define STORAGE_CRYPT_DEFAULT_UNIT    4096
+#define STORAGE_CRYPT_POOL_PAGES      256           /* Reserved bounce pages */
+#define STORAGE_CRYPT_MAX_IO \
+    ((STORAGE_CRYPT_POOL_PAGES / 4) * PAGE_SIZE)    /* Largest bounced write */
+
+/*
+ * Snapshot engine: copy-on-write radix tree of extents
+ * Each level resolves STORAGE_SNAP_FANOUT_BITS of the extent number.
+ */
+#define STORAGE_SNAP_EXTENT_SHIFT     16    /* 64KB extents bound COW copies */
+#define STORAGE_SNAP_EXTENT_SIZE      (1U << STORAGE_SNAP_EXTENT_SHIFT)
+#define STORAGE_SNAP_FANOUT_BITS      6
+#define STORAGE_SNAP_FANOUT           (1U << STORAGE_SNAP_FANOUT_BITS)
+#define STORAGE_SNAP_NAME_LEN         32
+#define STORAGE_SNAP_MAGIC            0x534E4150  /* "SNAP" */
+#define STORAGE_SNAP_MAX              64    /* Snapshots in the superblock */
+#define STORAGE_SNAP_META_BLOCK       4096  /* On-disk node and sb unit */
+
+/* Discard coalescing: dispatch on idle or once enough is queued */
+#define STORAGE_DISCARD_BATCH_BYTES   (64ULL * 1024 * 1024)
+#define STORAGE_DISCARD_IDLE_MS       100
+
+/* Thin provisioning */
+#define STORAGE_THIN_MAGIC            0x5448494E  /* "THIN" */
+#define STORAGE_THIN_DEFAULT_CHUNK    (1024 * 1024)
+#define STORAGE_THIN_UNMAPPED         0xFFFFFFFFU /* Free physical chunk */
+#define STORAGE_THIN_RMAP_LOCKS       64    /* Hashed reverse map block locks */
+
+/* Inline deduplication */
+#define STORAGE_DEDUP_MAGIC           0x44445550  /* "DDUP" */
+#define STORAGE_DEDUP_BLOCK_SIZE      4096
+#define STORAGE_DEDUP_SHARD_BITS      6
+#define STORAGE_DEDUP_NR_SHARDS       (1U << STORAGE_DEDUP_SHARD_BITS)
+#define STORAGE_DEDUP_BLOOM_BITS_PER  10    /* ~1% false positives with k=7 */
+#define STORAGE_DEDUP_NO_BLOCK        0xFFFFFFFFU /* Unwritten logical block */
+#define STORAGE_DEDUP_BLOOM_HASHES    7
+
+/* Request pool sizing */
+#define STORAGE_REQ_MAGAZINE_SIZE  32    /* Requests cached per CPU */
 
 /* Forward declarations - opaque handles for API users */
 struct storage_device;
 struct storage_context;
 struct storage_request;
+struct storage_hw_queue;
+
+/**
+ * Scatter-gather segment
+ * One piece of a caller buffer for vectored I/O; segments are consumed
+ * in array order and map to consecutive device offsets.
+ */
+struct storage_segment {
+    void *base;
+    size_t len;
+};
+
+/**
+ * Per-sector protection information
+ * The reference tag (low 32 bits of the sector number) catches data
+ * written to or read from the wrong location, which a CRC alone cannot.
+ */
+struct storage_pi_tuple {
+    __le32 crc;            /* CRC32C of the sector data */
+    __le32 ref_tag;        /* Expected sector number */
+};
 
 /**
  * Storage statistics structure
@@ -55,7 +233,8 @@ struct storage_stats {
     u64 write_errors;
     u64 timeout_errors;
 
-    /* Performance metrics */
+    /* Performance metrics (averages derived from the latency histograms;
+     * use storage_get_latency_histogram() for percentiles) */
     u64 avg_read_latency_us;
     u64 avg_write_latency_us;
     u64 max_queue_depth;
@@ -67,6 +246,162 @@ struct storage_stats {
 
     /* Last update timestamp */
     u64 last_update_ns;
+
+    /*
+     * Version 3 extensions - appended so a v1/v2 backend's get_stats,
+     * which only fills the fields above, still lines up. The core
+     * zeroes the whole structure before calling it.
+     */
+
+    /* Readahead statistics */
+    u64 readahead_bytes;         /* Bytes fetched speculatively */
+    u64 readahead_hits;          /* Reads served from readahead data */
+    u64 readahead_wasted_bytes;  /* Readahead evicted or invalidated unread */
+
+    /* Write-back statistics */
+    u64 wb_dirty_bytes;          /* Currently buffered, not yet written */
+    u64 wb_coalesced_bytes;      /* Bytes absorbed by overlapping writes */
+    u64 wb_backend_writes;       /* Writes issued by writeback */
+    u64 wb_throttle_events;      /* Writers blocked on the dirty limit */
+
+    /* Compression statistics (ratio = compress_bytes_in / _out) */
+    u64 compress_bytes_in;       /* Logical bytes written */
+    u64 compress_bytes_out;      /* Bytes stored after compression */
+    u64 compress_raw_chunks;     /* Chunks stored raw after the probe */
+    u64 compress_cpu_ns;         /* Time spent compressing */
+    u64 decompress_cpu_ns;       /* Time spent decompressing */
+
+    /* Snapshot statistics */
+    u64 snap_cow_extents;        /* Shared extents copied on write */
+    u64 snap_cow_bytes;          /* Extra bytes written by COW */
+
+    /* Discard coalescing statistics */
+    u64 discard_queued_bytes;    /* Bytes trimmed by callers */
+    u64 discard_issued;          /* Backend trim/erase calls */
+    u64 discard_issued_bytes;    /* Bytes trimmed on the backend */
+    u64 discard_cancelled_bytes; /* Dropped because they were rewritten */
+
+    /* Thin provisioning statistics */
+    u64 thin_mapped_chunks;      /* Physical chunks allocated */
+    u64 thin_zero_reads;         /* Reads of unmapped chunks served as zeros */
+
+    /* Deduplication statistics (ratio = dedup_blocks / unique) */
+    u64 dedup_blocks;            /* Blocks written through the layer */
+    u64 dedup_duplicates;        /* Blocks stored as references */
+    u64 dedup_bloom_skips;       /* Index lookups avoided by the filter */
+    u64 dedup_index_bytes;       /* Memory used by index and filter */
+    u64 dedup_write_ns;          /* Hashing and lookup time on writes */
+
+    /* Request merging statistics */
+    u64 requests_merged;         /* Requests folded into another I/O */
+
+    /* Request pool statistics */
+    u64 req_pool_hits;     /* Served from a per-CPU magazine */
+    u64 req_pool_misses;   /* Fell back to the depot or slab */
+
+    /* End-to-end protection statistics */
+    u64 integrity_errors;  /* Protection information mismatches */
+};
+
+/**
+ * Per-CPU statistics shard
+ * Completions only update the local CPU's shard, with interrupts off
+ * since they run from both process and IRQ context. The seqcount is
+ * real on every architecture, so storage_get_stats() copies a shard
+ * whose counters belong to one update, not just untorn u64s.
+ */
+struct storage_stats_shard {
+    seqcount_t seq;
+    struct storage_stats stats;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * Per-CPU latency histogram
+ * Bucket counts for each request type; merged by summing across CPUs.
+ */
+struct storage_lat_hist {
+    u64 buckets[STORAGE_LAT_NR_OPS][STORAGE_LAT_NR_BUCKETS];
+    u64 max_ns[STORAGE_LAT_NR_OPS];
+};
+
+/**
+ * Latency summary for one request type
+ * Values are bucket upper bounds, so percentiles are never under-reported.
+ */
+struct storage_latency_summary {
+    u64 count;             /* Requests recorded */
+    u64 p50_ns;
+    u64 p90_ns;
+    u64 p99_ns;
+    u64 p999_ns;
+    u64 max_ns;            /* Exact maximum observed */
+};
+
+/**
+ * Block cache entry
+ * CLOCK-Pro state: resident hot/cold pages plus non-resident cold
+ * "test" entries that remember recent evictions, so one-off scans stay
+ * cold and cannot flush the hot set.
+ */
+struct storage_cache_entry {
+    u64 block;                     /* Block number (offset / block_size) */
+    struct hlist_node hash;        /* Shard hash chain */
+    struct list_head clock;        /* Position on the shard's clock */
+    enum {
+        STORAGE_CACHE_HOT,
+        STORAGE_CACHE_COLD,
+        STORAGE_CACHE_TEST         /* Non-resident, data == NULL */
+    } state;
+    bool referenced;               /* Set on hit, cleared by the hands */
+    bool readahead;                /* Read ahead and not yet read; the first
+                                    * hit counts readahead_hits and clears it,
+                                    * eviction or invalidation while set adds
+                                    * block_size to readahead_wasted_bytes */
+    void *data;                    /* block_size bytes when resident */
+};
+
+/**
+ * Block cache shard
+ * Blocks are spread over shards by hashed block number; each shard has
+ * its own lock, hash table and clock.
+ */
+struct storage_cache_shard {
+    spinlock_t lock;
+    struct hlist_head *buckets;
+    u32 hash_bits;
+
+    /* Clock and its three CLOCK-Pro hands */
+    struct list_head clock;
+    struct list_head *hand_hot;
+    struct list_head *hand_cold;
+    struct list_head *hand_test;
+
+    /* Population and adaptive cold target, in blocks */
+    u32 nr_hot;
+    u32 nr_cold;
+    u32 nr_test;
+    u32 cold_target;
+    u32 capacity;
+
+    /* Bumped under lock by every invalidation touching this shard; a
+     * fill whose sample no longer matches drops its data */
+    u64 inval_seq;
+
+    /* Per-shard counters, folded into storage_stats */
+    u64 hits;
+    u64 misses;
+    u64 evictions;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * Block cache
+ * Sits between storage_read() and ops->read; hits never reach the backend.
+ */
+struct storage_cache {
+    u64 size_bytes;                /* Total resident capacity */
+    u32 block_size;                /* Caching granularity, power of two */
+    u32 block_shift;
+    struct storage_cache_shard shards[STORAGE_CACHE_NR_SHARDS];
 };
 
 /**
@@ -119,7 +454,12 @@ struct storage_ops {
     int (*trim)(struct storage_context *ctx, u64 offset, size_t len);
     int (*sync)(struct storage_context *ctx);
 
-    /* Asynchronous operations */
+    /*
+     * Asynchronous operations. The core fills in req->ctx, type, offset,
+     * length, buffer or segs/nr_segs and flags before the call; backends
+     * treat them as read-only and only finish the request through
+     * storage_request_complete().
+     */
     int (*read_async)(struct storage_context *ctx, u64 offset,
                      void *buf, size_t len, u32 flags,
                      struct storage_request *req);
@@ -148,6 +488,645 @@ struct storage_ops {
 
     /* Internal data - opaque to users */
     void *private_data;
+
+    /*
+     * Version 3 extensions - appended so the v1/v2 layout above is
+     * unchanged. All are optional; the core reads them only when
+     * version >= 3.
+     */
+
+    /*
+     * Vectored operations - optional. The segment array is passed through
+     * unchanged. Without readv/writev the synchronous API issues one
+     * plain op per segment; without readv_async/writev_async the async
+     * vectored API fails with -EOPNOTSUPP for more than one segment.
+     */
+    int (*readv)(struct storage_context *ctx, u64 offset,
+                const struct storage_segment *segs, unsigned int nr_segs,
+                u32 flags);
+    int (*writev)(struct storage_context *ctx, u64 offset,
+                 const struct storage_segment *segs, unsigned int nr_segs,
+                 u32 flags);
+    int (*readv_async)(struct storage_context *ctx, u64 offset,
+                      const struct storage_segment *segs,
+                      unsigned int nr_segs, u32 flags,
+                      struct storage_request *req);
+    int (*writev_async)(struct storage_context *ctx, u64 offset,
+                       const struct storage_segment *segs,
+                       unsigned int nr_segs, u32 flags,
+                       struct storage_request *req);
+
+    /*
+     * End-to-end protection - optional, used when the device reports
+     * has_end_to_end_protection. @pi holds one tuple per sector; the
+     * backend stores it with the data and returns it on read.
+     */
+    int (*read_pi)(struct storage_context *ctx, u64 offset, void *buf,
+                  size_t len, struct storage_pi_tuple *pi, u32 flags);
+    int (*write_pi)(struct storage_context *ctx, u64 offset, const void *buf,
+                   size_t len, const struct storage_pi_tuple *pi, u32 flags);
+
+    /*
+     * Batched submission - optional, called on unplug with every request
+     * accumulated under the plug. Backends ring their doorbell once per
+     * batch. If NULL, requests are dispatched one by one through
+     * read_async/write_async. The backend owns every request it is
+     * given: any it fails to queue it completes itself with the error,
+     * so the return value (first error, or 0) is informational and the
+     * core never completes those requests again.
+     */
+    int (*submit_batch)(struct storage_context *ctx,
+                       struct storage_request **reqs, unsigned int nr);
+
+    /*
+     * Completion polling - optional, required for STORAGE_CTX_POLLED.
+     * Reaps up to @max finished requests on @hwq without waiting for an
+     * interrupt and completes them. Returns the number reaped.
+     */
+    int (*poll)(struct storage_context *ctx, struct storage_hw_queue *hwq,
+               unsigned int max);
+
+    /*
+     * Timeout handling - optional. Called when a request outlives the
+     * context's timeout_ms, with the request in STORAGE_REQ_TIMED_OUT.
+     * Return STORAGE_TIMEOUT_DONE once the backend has aborted the I/O
+     * (the core then completes it), STORAGE_TIMEOUT_RESET_TIMER to
+     * grant it another timeout period. Must not call
+     * storage_request_complete() itself.
+     */
+    int (*timeout)(struct storage_context *ctx, struct storage_request *req);
+
+    /* Multi-queue setup - optional, single queue assumed if NULL */
+    int (*init_hw_queue)(struct storage_context *ctx,
+                        struct storage_hw_queue *hwq);
+    void (*exit_hw_queue)(struct storage_context *ctx,
+                         struct storage_hw_queue *hwq);
+
+    /* Batched completion - preferred over completion_notify if set */
+    void (*completion_notify_batch)(struct storage_context *ctx,
+                                   struct storage_request **reqs,
+                                   unsigned int nr);
+};
+
+/**
+ * Per-CPU software submission queue
+ * Submitters push onto their own CPU's queue without taking any lock;
+ * the owning hardware queue drains it in batches during dispatch.
+ */
+struct storage_sw_queue {
+    struct llist_head submitted;  /* Lock-free LIFO of new requests */
+    u16 hw_queue;                 /* Hardware queue this CPU maps onto */
+    u64 nr_submitted;             /* Only touched by the owning CPU */
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Request ownership states (storage_request.state)
+ * Completion and timeout expiry race for an in-flight request; each
+ * moves it out of IN_FLIGHT with cmpxchg and only the winner delivers
+ * the completion, as in blk-mq.
+ */
+enum storage_req_state {
+    STORAGE_REQ_IDLE,               /* Not submitted */
+    STORAGE_REQ_IN_FLIGHT,          /* Owned by the backend */
+    STORAGE_REQ_TIMED_OUT,          /* Owned by the timeout path */
+    STORAGE_REQ_COMPLETE,           /* Completion delivered or pending */
+};
+
+/* Return values of storage_ops.timeout */
+enum storage_timeout_ret {
+    STORAGE_TIMEOUT_DONE,
+    STORAGE_TIMEOUT_RESET_TIMER,
+};
+
+/**
+ * Hierarchical timing wheel for request timeouts
+ * Requests are armed in batches at dispatch and cancelled in batches at
+ * completion, never on the submission path. Insert and cancel are O(1);
+ * expiry handles a whole slot per tick and cascades coarser levels
+ * down as finer ones wrap.
+ */
+struct storage_timer_wheel {
+    spinlock_t lock;
+    u64 clock;                      /* Current tick */
+    u32 nr_armed;
+    struct hlist_head slots[STORAGE_TW_LEVELS][STORAGE_TW_SLOTS];
+    struct timer_list tick;         /* Runs only while nr_armed != 0 */
+};
+
+/**
+ * Hardware dispatch queue
+ * One per backend submission channel, bounded by storage_caps.max_queue_depth
+ */
+struct storage_hw_queue {
+    struct storage_context *ctx;  /* Context owning this queue */
+    u16 index;                    /* Queue number passed to the backend */
+    u32 depth;                    /* Max in-flight requests on this queue */
+    atomic_t inflight;            /* Requests currently owned by backend */
+
+    /* Dispatch list, only touched by the draining context */
+    struct list_head dispatch;
+    spinlock_t dispatch_lock;
+
+    /* Software queues feeding this queue */
+    cpumask_var_t cpus;
+
+    /* Timeouts of requests dispatched on this queue */
+    struct storage_timer_wheel timeouts;
+
+    /* Backend-private per-queue data (doorbell, ring, ...) */
+    void *private_data;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * Submission plug
+ * Lives on the submitter's stack between storage_plug() and
+ * storage_unplug(); async requests the owning task issues in between
+ * are chained here through req->list instead of being dispatched
+ * individually. Like struct blk_plug it is a list head and a count, so
+ * it stays small on the stack however many requests it holds.
+ */
+struct storage_plug {
+    struct storage_context *ctx;  /* Context the plug belongs to */
+    struct task_struct *owner;    /* Task that started the plug */
+    struct list_head requests;    /* Held requests, in submission order */
+    unsigned int nr_requests;     /* Requests currently held */
+};
+
+/**
+ * Per-CPU request magazine
+ * Small LIFO stack of free requests; alloc and free on the owning CPU
+ * touch nothing shared. Requests are freed from completion interrupts,
+ * so the magazine is guarded by an IRQ-disabling local lock.
+ */
+struct storage_req_magazine {
+    local_lock_t lock;
+    unsigned int nr;                /* Requests currently cached */
+    u64 hits;                       /* Allocations served locally */
+    u64 misses;                     /* Allocations that had to refill */
+    struct storage_request *objs[STORAGE_REQ_MAGAZINE_SIZE];
+} ____cacheline_aligned_in_smp;
+
+/**
+ * Request pool
+ * Preallocated to the context's queue_depth at open; magazines exchange
+ * batches with the shared depot only when they run empty or full.
+ */
+struct storage_req_pool {
+    struct storage_req_magazine __percpu *magazines;
+
+    /* Shared depot of free requests, refilled/drained in batches */
+    struct llist_head depot;
+    atomic_t depot_count;
+
+    /* Backing slab for growth beyond the preallocated set */
+    struct kmem_cache *cache;
+    u32 prealloc;                   /* Requests allocated up front */
+
+    /* STORAGE_MAX_SEGMENTS arrays for merged requests */
+    struct kmem_cache *seg_cache;
+};
+
+/**
+ * Per-context readahead state
+ * Tracks one access stream; only the context's reader updates it.
+ */
+struct storage_readahead {
+    u64 last_offset;       /* Start of previous read */
+    u64 last_len;          /* Length of previous read */
+    s64 stride;            /* Detected gap between reads, 0 = sequential */
+    u32 matches;           /* Consecutive reads matching the pattern */
+
+    /* Current window */
+    u64 start;             /* First byte of the last readahead */
+    u64 size;              /* Window size, doubles on hit, halves on miss */
+    u64 async_start;       /* Reading past here triggers the next window */
+    u64 max_size;          /* Ceiling, at most max_transfer_size */
+};
+
+/**
+ * Dirty extent
+ * A contiguous buffered range; overlapping and adjacent writes are
+ * merged into one extent before it reaches the backend.
+ */
+struct storage_dirty_extent {
+    struct rb_node node;   /* Keyed by offset in storage_writeback.extents */
+    u64 offset;
+    size_t len;
+    void *data;
+    u64 dirtied_ns;        /* Age of the oldest data in the extent */
+};
+
+/**
+ * Per-device write-back state
+ * Dirty extents are the newest copy of their range: every read path
+ * copies them over what the backend returns, and every write that goes
+ * to the backend directly first trims or splits the extents it
+ * overlaps under @lock, so stale buffered data is never written back
+ * over it.
+ */
+struct storage_writeback {
+    spinlock_t lock;                /* Protects extents and dirty_bytes */
+    struct rb_root extents;         /* Non-overlapping dirty extents */
+    u64 dirty_bytes;                /* WRITE_ONCE under lock, read lock-free */
+
+    /* Limits: writers throttle at dirty_limit, background starts earlier */
+    u64 dirty_limit;
+    u64 background_thresh;
+    wait_queue_head_t throttle_wait;
+
+    /* Background writeback, emits optimal_io_size aligned writes */
+    struct delayed_work work;
+    struct mutex flush_lock;        /* Serialises writeback and storage_flush */
+};
+
+/**
+ * I/O scheduler operations
+ * A policy sits between the hardware queues and the backend's async ops.
+ * Its queues live in dev->sched_data, one set per hardware queue index
+ * shared by every context of the device, so policies such as "wfq" can
+ * order requests across contexts. Hardware queues are per context, so
+ * their dispatch_lock does not cover that shared state; the policy
+ * takes its own lock. dispatch() may return a request of another
+ * context, which the core issues on req->ctx and req->hw_queue.
+ */
+struct storage_sched_ops {
+    char name[STORAGE_SCHED_NAME_LEN];
+
+    /* Lifetime - attach policy state to a device */
+    int (*init)(struct storage_device *dev);
+    void (*exit)(struct storage_device *dev);
+
+    /* Queueing */
+    void (*insert)(struct storage_device *dev, struct storage_hw_queue *hwq,
+                   struct storage_request *req);
+    struct storage_request *(*dispatch)(struct storage_device *dev,
+                                        struct storage_hw_queue *hwq);
+    bool (*has_work)(struct storage_device *dev, struct storage_hw_queue *hwq);
+
+    /* Optional - completion feedback, e.g. for fair-queuing accounting */
+    void (*completed)(struct storage_device *dev, struct storage_request *req);
+
+    /* Scheduler registry linkage */
+    struct list_head list;
+};
+
+/**
+ * Completion batch
+ * Backends collect finished requests here (typically on the stack while
+ * reaping a completion ring) and hand them to the core in one call.
+ */
+struct storage_completion_batch {
+    unsigned int nr;
+    struct storage_request *reqs[STORAGE_COMPLETION_BATCH];
+};
+
+/**
+ * Batch completion handler
+ * Receives finished requests of one context; result and
+ * bytes_transferred are already set. Per-request completion callbacks
+ * are not invoked when a handler is registered.
+ */
+typedef void (*storage_batch_complete_fn)(struct storage_context *ctx,
+                                          struct storage_request **reqs,
+                                          unsigned int nr, void *data);
+
+/**
+ * Compression layer state
+ * Sits above the backend ops; the chunk map translates logical chunks
+ * to variable-size extents on the backend. A rewritten chunk gets a new
+ * extent; the old one is released in sector_bitmap only after the map
+ * block pointing at the new extent is on the backend, so a crash leaves
+ * either the old or the new chunk, never a torn one.
+ */
+struct storage_compress {
+    u32 chunk_size;                 /* Logical chunk, power of two */
+    u64 nr_chunks;
+    u64 *chunk_map;                 /* Packed STORAGE_CMAP_* entries */
+    u64 map_sectors;                /* Backend sectors holding the map */
+
+    /* Map blocks updated since the last flush, written by storage_flush */
+    unsigned long *map_dirty;
+    struct mutex map_lock;
+
+    /* Extent allocator: next-fit over the data sectors after the map */
+    spinlock_t alloc_lock;
+    unsigned long *sector_bitmap;   /* Set = sector in use */
+    u64 nr_sectors;
+    u64 alloc_cursor;
+
+    /*
+     * A partial chunk write reads, decompresses, merges and recompresses
+     * the whole chunk under the chunk's hashed lock, so two writers into
+     * the same chunk cannot each merge into a stale copy.
+     */
+    struct mutex chunk_locks[STORAGE_COMPRESS_CHUNK_LOCKS];
+
+    /* Worker pool: chunks of one request compress/decompress in parallel */
+    struct workqueue_struct *workers;
+    void * __percpu *workspace;     /* LZ4_MEM_COMPRESS per CPU */
+};
+
+/**
+ * Per-CPU encryption state
+ * Preallocated so the I/O path never allocates a cipher request. Only
+ * used between get_cpu_ptr() and put_cpu_ptr() around one synchronous
+ * encrypt or decrypt, never across a call into the backend.
+ */
+struct storage_crypt_pcpu {
+    struct skcipher_request *req;
+    struct scatterlist sg[2];
+};
+
+/**
+ * Encryption layer state
+ * The synchronous "xts(aes)" transform resolves to the AES-NI or VAES
+ * multi-block implementation when the CPU has it.
+ */
+struct storage_crypt {
+    struct crypto_skcipher *tfm;
+    u32 data_unit_size;             /* Bytes per XTS tweak, power of two */
+    u32 data_unit_shift;
+    struct storage_crypt_pcpu __percpu *pcpu;
+
+    /*
+     * Write bounce pages, as dm-crypt. A write first tries GFP_NOWAIT;
+     * if the pool runs dry it takes bounce_lock and allocates the rest
+     * with GFP_NOIO. Only the lock holder can sleep on the pool, and no
+     * write needs more than STORAGE_CRYPT_MAX_IO, so it always finishes
+     * once in-flight writes release their pages.
+     */
+    mempool_t *bounce_pool;
+    struct mutex bounce_lock;
+};
+
+/**
+ * Copy-on-write radix tree node
+ * Nodes are shared between the live tree and snapshots and never
+ * modified while shared: a writer shadows every node on its path whose
+ * refcount is above one. Unshared live leaves (refcount 1) are updated
+ * in place with WRITE_ONCE(), so lockless readers use READ_ONCE().
+ * Leaves hold physical extent number + 1 (0 = unmapped); interior
+ * nodes hold child pointers.
+ */
+struct storage_snap_node {
+    atomic_t refcount;              /* Trees and parents referencing us */
+    struct rcu_head rcu;
+    u64 blocknr;                    /* Committed metadata block, 0 if none */
+    struct list_head dirty;         /* On snap_store.dirty_nodes if changed */
+    union {
+        struct storage_snap_node __rcu *children[STORAGE_SNAP_FANOUT];
+        u64 extents[STORAGE_SNAP_FANOUT];
+    };
+};
+
+/**
+ * On-disk tree node, one STORAGE_SNAP_META_BLOCK
+ * Interior slots hold child block numbers, leaf slots extent number + 1.
+ */
+struct storage_snap_node_disk {
+    __le64 slots[STORAGE_SNAP_FANOUT];
+    __le64 generation;              /* Commit that wrote this node */
+    __le32 crc;                     /* CRC32C of slots and generation */
+} __packed;
+
+/**
+ * On-disk snapshot table entry
+ */
+struct storage_snap_disk {
+    __le64 root;                    /* Root node block, 0 for empty */
+    __le64 created_ns;
+    __le32 id;
+    u8 height;
+    u8 reserved[3];
+    char name[STORAGE_SNAP_NAME_LEN];
+} __packed;
+
+/**
+ * Snapshot superblock, written with STORAGE_OP_FUA to end a commit
+ * Two copies alternate by generation; open picks the newer valid one.
+ */
+struct storage_snap_sb {
+    __le32 magic;
+    __le32 nr_snapshots;
+    __le64 generation;
+    __le64 live_root;               /* Live tree root block */
+    __le64 meta_blocks;             /* Metadata area size in blocks */
+    __le64 nr_extents;
+    u8 height;
+    u8 reserved[3];
+    struct storage_snap_disk snapshots[STORAGE_SNAP_MAX];
+    __le32 crc;                     /* CRC32C of the superblock */
+} __packed;
+
+/**
+ * Point-in-time snapshot
+ * Holds a reference on the tree root as it was at creation.
+ */
+struct storage_snapshot {
+    u32 id;
+    char name[STORAGE_SNAP_NAME_LEN];
+    struct storage_snap_node *root;  /* Immutable while referenced */
+    u8 height;
+    u64 created_ns;
+    struct list_head list;
+};
+
+/**
+ * Per-device snapshot state
+ * The trees are persisted copy-on-write: storage_flush() writes every
+ * dirty node to a newly allocated metadata block (children before
+ * parents), flushes the backend, then writes the superblock with the
+ * new live root. The previous commit stays intact on disk until then,
+ * and its blocks are only freed afterwards.
+ */
+struct storage_snap_store {
+    /* Live tree; write_lock serialises live writers only */
+    struct storage_snap_node __rcu *live_root;
+    u8 height;
+    struct mutex write_lock;
+
+    /* Physical extent allocator and shared-extent refcounts */
+    u64 nr_extents;
+    u32 *extent_refs;               /* Trees referencing each extent */
+    unsigned long *extent_free;     /* Free extent bitmap */
+
+    /* Snapshot list, protected by write_lock */
+    struct list_head snapshots;
+    u32 next_id;
+
+    /* Metadata area and commit state, protected by write_lock */
+    u64 meta_blocks;
+    unsigned long *meta_free;       /* Free metadata block bitmap */
+    struct list_head dirty_nodes;   /* Changed since the last commit */
+    u64 generation;
+};
+
+/**
+ * Queued discard range
+ * Byte range [start, last] waiting to be trimmed. struct
+ * interval_tree_node has unsigned long endpoints, which truncate byte
+ * offsets above 4GB on 32-bit, so the tree operations are generated by
+ * INTERVAL_TREE_DEFINE() over these u64 fields in the implementation.
+ */
+struct storage_discard_range {
+    struct rb_node rb;
+    u64 start;
+    u64 last;                       /* Inclusive */
+    u64 subtree_last;               /* Augmented max of last below rb */
+};
+
+/**
+ * Per-device discard queue
+ * Ranges never overlap or touch: inserts absorb every neighbour they
+ * overlap or abut, writes carve out what they rewrite, and dispatch
+ * trims each range aligned to the device granularity.
+ */
+struct storage_discard_queue {
+    spinlock_t lock;
+    struct rb_root_cached ranges;
+    u64 pending_bytes;
+    u32 granularity;                /* Alignment of issued trims, power of two */
+
+    /* Dispatch trigger: idle timeout or batch threshold */
+    u64 batch_bytes;
+    struct delayed_work work;
+};
+
+/**
+ * Thin provisioning on-disk superblock
+ * Followed on the backend by the reverse map: one __le32 logical chunk
+ * number per physical chunk (STORAGE_THIN_UNMAPPED if free). Its size is
+ * bounded by real capacity, not by the overcommitted logical size, and
+ * open rebuilds the forward map with a single sequential read.
+ */
+struct storage_thin_sb {
+    __le32 magic;
+    __le32 version;
+    __le32 chunk_size;
+    __le32 reserved;
+    __le64 logical_chunks;
+    __le64 physical_chunks;
+    __le64 data_start;              /* Byte offset of physical chunk 0 */
+    __le32 crc;                     /* CRC32C of the superblock */
+} __packed;
+
+/**
+ * Thin provisioning layer state
+ * The forward map is an xarray (the kernel radix tree) of
+ * xa_mk_value(physical chunk) entries: xa_load() is lock-free under RCU
+ * and nodes pack 64 entries per cache-friendly slot array.
+ */
+struct storage_thin {
+    u32 chunk_size;
+    u32 chunk_shift;
+    u64 logical_chunks;
+    u64 physical_chunks;
+    u64 data_start;
+
+    struct xarray map;              /* Logical chunk -> physical chunk */
+
+    /* Allocation on first write; alloc_lock covers the bitmap only */
+    spinlock_t alloc_lock;
+    unsigned long *free_chunks;     /* Bitmap of free physical chunks */
+    u64 alloc_hint;
+
+    /*
+     * First write to a logical chunk: xa_reserve() the slot (readers
+     * still see a hole, other writers to it sleep on alloc_wait), take
+     * a chunk under alloc_lock, zero the parts of it the write does not
+     * cover, write the data, then persist the reverse map entry and only
+     * then xa_store() the mapping. No lock is held across the data I/O,
+     * so first writes to different chunks proceed in parallel. A crash
+     * before the reverse map write leaves the chunk free, never mapped
+     * to stale or unwritten data.
+     */
+    wait_queue_head_t alloc_wait;
+
+    /*
+     * Reverse map image; an entry is persisted by writing its enclosing
+     * rmap_io_size block (storage_caps.min_io_size, so O_DIRECT backends
+     * accept it) with STORAGE_OP_FUA under that block's hashed lock.
+     */
+    __le32 *rmap;
+    u32 rmap_io_size;
+    struct mutex rmap_locks[STORAGE_THIN_RMAP_LOCKS];
+};
+
+/**
+ * Fingerprint index entry (16 bytes)
+ * xxh64 is not collision resistant, so a fingerprint match is confirmed
+ * by comparing block contents before a write becomes a reference.
+ */
+struct storage_dedup_entry {
+    u64 fingerprint;
+    u32 block;                      /* Physical block holding the data */
+    u32 refcount;                   /* Logical blocks referencing it */
+};
+
+/**
+ * Deduplication on-disk superblock
+ * Followed on the backend by the logical map (one __le32 physical block
+ * per logical block, STORAGE_DEDUP_NO_BLOCK if unwritten) and then the
+ * fingerprint table (one __le64 per physical block). Refcounts, the
+ * index and the Bloom filter are not stored: open rebuilds them from
+ * the two tables with sequential reads.
+ */
+struct storage_dedup_sb {
+    __le32 magic;
+    __le32 block_size;
+    __le64 logical_blocks;
+    __le64 physical_blocks;
+    __le64 map_start;               /* Byte offset of the logical map */
+    __le64 fp_start;                /* Byte offset of the fingerprint table */
+    __le64 data_start;              /* Byte offset of physical block 0 */
+    __le32 crc;                     /* CRC32C of the superblock */
+} __packed;
+
+/**
+ * Fingerprint index shard
+ * Open-addressed table selected by the top fingerprint bits.
+ */
+struct storage_dedup_shard {
+    spinlock_t lock;
+    struct storage_dedup_entry *table;
+    u32 mask;                       /* Table size - 1, power of two */
+    u32 used;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * Deduplication layer state
+ * A Bloom filter in front of the index answers "never seen" without
+ * touching any shard; only possible duplicates take a shard lock.
+ *
+ * Overwriting a logical block looks up the fingerprint of the physical
+ * block it pointed to in phys_fp, drops that entry's refcount and, at
+ * zero, removes the entry and returns the block to free_blocks. Bloom
+ * bits are never cleared; a stale bit only costs one index lookup.
+ *
+ * A write stores new data and its phys_fp slot first, then the logical
+ * map block with STORAGE_OP_FUA; the old block is released in memory
+ * only after that, so a crash never leaves a map entry pointing at a
+ * block that was reused.
+ */
+struct storage_dedup {
+    u32 block_size;
+    u64 logical_blocks;
+    u64 map_start;                  /* On-disk layout from storage_dedup_sb */
+    u64 fp_start;
+    u64 data_start;
+    struct mutex map_lock;          /* Orders on-disk map block updates */
+
+    unsigned long *bloom;
+    u64 bloom_mask;                 /* Filter bits - 1, power of two */
+    struct storage_dedup_shard shards[STORAGE_DEDUP_NR_SHARDS];
+    u32 *logical_map;               /* Logical -> physical, or NO_BLOCK */
+
+    /* Physical block allocator and reverse map */
+    spinlock_t alloc_lock;
+    unsigned long *free_blocks;     /* Bitmap of unused physical blocks */
+    u32 nr_blocks;
+    u32 alloc_hint;
+    u64 *phys_fp;                   /* Physical block -> fingerprint */
 };
 
 /**
@@ -172,19 +1151,64 @@ struct storage_device {
     /* Device-specific data */
     void *private_data;
 
-    /* Child contexts */
+    /* Child contexts: RCU list, contexts_lock serialises open/close only */
     struct list_head contexts;
     struct mutex contexts_lock;
 
-    /* Statistics */
+    /* Statistics: hot counters live in per-CPU shards, global_stats
+     * holds slow-path counters and is the aggregation base */
     struct storage_stats global_stats;
+    struct storage_stats_shard __percpu *stats_shards;
+    struct storage_lat_hist __percpu *lat_hist;
+
+    /* Block cache, NULL when caching is disabled */
+    struct storage_cache *cache;
+
+    /*
+     * Data layers. Encryption sits directly above the backend and
+     * covers every byte, metadata included. Above it at most one
+     * remapping layer (compression, snapshots, thin provisioning or
+     * deduplication) owns the backend address space and its metadata;
+     * attaching a second one fails with -EBUSY, see storage_remap_attached().
+     */
+
+    /* Transparent compression, NULL unless STORAGE_FEATURE_COMPRESSION */
+    struct storage_compress *compress;
+
+    /* Encryption, NULL unless STORAGE_FEATURE_ENCRYPTION */
+    struct storage_crypt *crypt;
+
+    /* Snapshots, NULL unless STORAGE_FEATURE_SNAPSHOTS */
+    struct storage_snap_store *snaps;
+
+    /* Queued trims, NULL when trims go straight to the backend */
+    struct storage_discard_queue *discards;
+
+    /* Thin provisioning, NULL for fully provisioned devices */
+    struct storage_thin *thin;
+
+    /* Inline deduplication, NULL when disabled */
+    struct storage_dedup *dedup;
+
+    /* Write-back buffering, NULL for write-through */
+    struct storage_writeback *writeback;
+
+    /* I/O scheduler; switched under sched_lock with queues quiesced */
+    const struct storage_sched_ops *sched;
+    void *sched_data;
+    struct mutex sched_lock;
 
     /* Power management */
     u32 current_power_state;
     struct mutex power_lock;
 
-    /* Reference counting */
-    atomic_t refcount;
+    /* Reference counting: per-CPU while live, atomic after
+     * storage_destroy_device() kills it; ref_done fires at zero */
+    struct percpu_ref refcount;
+    struct completion ref_done;
+
+    /* Deferred free once RCU readers of the registry are done */
+    struct rcu_head rcu;
 
     /* Magic number for corruption detection */
     u32 magic;
@@ -207,7 +1231,36 @@ struct storage_context {
     u32 timeout_ms;
     bool read_only;
 
-    /* Request queue */
+    /* Snapshot this context reads from, NULL for the live device */
+    struct storage_snapshot *snapshot;
+
+    /* Multi-queue submission path */
+    struct storage_sw_queue __percpu *sw_queues;
+    struct storage_hw_queue *hw_queues;
+    u16 nr_hw_queues;
+
+    /* Preallocated request pool, sized from queue_depth */
+    struct storage_req_pool *req_pool;
+
+    /* Optional consumer batch completion handler */
+    storage_batch_complete_fn batch_complete;
+    void *batch_complete_data;
+
+    /* Polling: running mean of request service time for hybrid sleep */
+    u64 poll_mean_ns;
+
+    /* Weighted fair-queuing share and virtual finish time */
+    u32 sched_weight;
+    u64 sched_vtime;
+
+    /* Sequential/strided stream detection for storage_read() */
+    struct storage_readahead ra;
+
+    /* Active plug and the task owning it; other tasks never see it */
+    struct storage_plug *plug;
+    struct task_struct *plug_owner;
+
+    /* Slow-path requeue list (busy backend, error retry) */
     struct list_head pending_requests;
     spinlock_t queue_lock;
     wait_queue_head_t queue_wait;
@@ -220,8 +1273,14 @@ struct storage_context {
     /* Private data for backend */
     void *private;
 
-    /* List node for device's context list */
+    /* In-flight I/O references: every request holds one, per-CPU until
+     * storage_close_context() switches to atomic mode and drains */
+    struct percpu_ref io_ref;
+    struct completion io_done;
+
+    /* List node for device's context list (RCU) */
     struct list_head list;
+    struct rcu_head rcu;
 
     /* Synchronization for context-wide operations */
     struct mutex lock;
@@ -241,6 +1300,14 @@ struct storage_request {
     void *buffer;
     u32 flags;
 
+    /* Protection information, one tuple per sector, NULL if unused */
+    struct storage_pi_tuple *pi;
+
+    /* Vectored form: when nr_segs != 0, segs describes the data and
+     * buffer is unused */
+    const struct storage_segment *segs;
+    unsigned int nr_segs;
+
     /* Request type */
     enum {
         STORAGE_REQ_READ,
@@ -262,11 +1329,53 @@ struct storage_request {
     u64 completion_time_ns;
 
     /* List management */
-    struct list_head list;
+    struct list_head list;       /* Plug, requeue or dispatch list */
+    struct llist_node sw_node;   /* Link on a per-CPU software queue */
+    u16 hw_queue;                /* Dispatch queue the request went to */
 
     /* Reference count for async operations */
     atomic_t refcount;
 
+    /* Owning pool, NULL for caller-allocated requests */
+    struct storage_req_pool *pool;
+
+    /* Ownership state, enum storage_req_state */
+    atomic_t state;
+
+    /* Backend result that arrived while the timeout path owned the
+     * request; published by storage_request_stash() */
+    int stash_result;
+    size_t stash_bytes;
+    bool stashed;
+
+    /* Timeout wheel linkage, in wheel ticks. expires is the slot the
+     * request sits in; deadline is the real expiry, which may lie beyond
+     * the wheel's range and then takes several passes */
+    struct hlist_node timeout_node;
+    u64 timeout_expires;
+    u64 timeout_deadline;
+
+    /* Scheduler bookkeeping: expiry for deadline, virtual finish time
+     * for fair queuing, sorted position for either */
+    u64 sched_key;
+    struct rb_node sched_node;
+
+    /* Submitting context, set by the core before dispatch */
+    struct storage_context *ctx;
+
+    /* Merging: the head request carries the combined range and owns the
+     * merged requests, which complete individually when it finishes.
+     * A vectored merge gathers every member's data into merge_segs, one
+     * STORAGE_MAX_SEGMENTS array from the pool's seg_cache; the head's
+     * own buffer or segs are restored before it completes */
+    struct list_head merged;
+    struct storage_request *merge_head;
+    struct storage_segment *merge_segs;
+
+    /* Bounce pages of an encrypted async write, freed at completion */
+    struct storage_segment *crypt_segs;
+    unsigned int nr_crypt_segs;
+
     /* Request identifier */
     u64 req_id;
 };
@@ -306,9 +1415,39 @@ int storage_register_backend(const struct storage_ops *ops);
 /**
  * Unregister a storage backend
  * @ops: Pointer to operations structure to unregister
+ *
+ * Unlinks the backend and waits for an RCU grace period, so no lookup
+ * can still return it once this returns.
  */
 void storage_unregister_backend(const struct storage_ops *ops);
 
+/**
+ * Look up a registered backend by name
+ * @name: Backend name (storage_ops.name)
+ *
+ * Lock-free: walks an RCU-protected hash table. The result is stable
+ * only inside the caller's rcu_read_lock() section.
+ * Returns: Operations structure, or NULL if not registered
+ */
+const struct storage_ops *storage_find_backend(const char *name);
+
+/**
+ * Look up a device by id and take a reference
+ * @id: Device id (storage_device.id)
+ *
+ * Lock-free: devices are indexed in an xarray and the reference is
+ * taken with percpu_ref_tryget_live(), so a device being destroyed is
+ * never returned. Drop the reference with storage_put_device().
+ * Returns: Device pointer, or NULL if not found
+ */
+struct storage_device *storage_get_device_by_id(u32 id);
+
+/**
+ * Drop a device reference taken by storage_get_device_by_id()
+ * @dev: Storage device
+ */
+void storage_put_device(struct storage_device *dev);
+
 /**
  * Create and initialize a storage device
  * @name: Human-readable device name
@@ -321,12 +1460,18 @@ struct storage_device *storage_create_device(const char *name,
 /**
  * Destroy a storage device and clean up resources
  * @dev: Device to destroy
+ *
+ * Kills the device refcount (switching it to atomic mode), waits on
+ * ref_done until every holder has dropped its reference, then frees.
  */
 void storage_destroy_device(struct storage_device *dev);
 
 /**
  * Open a storage context for I/O operations
  * @dev: Storage device
+ *
+ * Publishes the context on dev->contexts with list_add_rcu(); readers
+ * walking the list never block on open or close.
  * Returns: Context pointer on success, NULL on failure
  */
 struct storage_context *storage_open_context(struct storage_device *dev);
@@ -334,6 +1479,10 @@ struct storage_context *storage_open_context(struct storage_device *dev);
 /**
  * Close a storage context
  * @ctx: Context to close
+ *
+ * Kills io_ref so new submissions fail with -ENODEV, waits on io_done
+ * for in-flight requests, then drops the context's device reference.
+ * Unlinks with list_del_rcu() and frees the context after a grace period.
  */
 void storage_close_context(struct storage_context *ctx);
 
@@ -344,6 +1493,21 @@ void storage_close_context(struct storage_context *ctx);
  * @buf: Buffer to read into
  * @len: Number of bytes to read
  * @flags: Operation flags
+ *
+ * Blocks present in the device's cache are copied out without calling
+ * ops->read; only missing blocks are fetched and then inserted.
+ * STORAGE_OP_NOCACHE skips both lookup and insertion.
+ *
+ * With write-back enabled, dirty extents overlapping the range are
+ * copied over the result under the write-back lock, so a read always
+ * sees buffered writes that have not reached the backend yet. The same
+ * overlay is applied by storage_readv() and, at completion, by
+ * storage_read_async().
+ *
+ * When the device has end-to-end protection, every sector is verified
+ * against its protection information unless STORAGE_OP_NOPI is set;
+ * a mismatch fails with -EBADMSG and storage_get_last_error() reports
+ * the failing offset.
  * Returns: Number of bytes read on success, negative error on failure
  */
 int storage_read(struct storage_context *ctx, u64 offset,
@@ -356,6 +1520,11 @@ int storage_read(struct storage_context *ctx, u64 offset,
  * @buf: Buffer containing data to write
  * @len: Number of bytes to write
  * @flags: Operation flags
+ *
+ * With write-back enabled the data is merged into the dirty extents and
+ * the call returns once buffered, blocking while dirty data is above the
+ * limit. STORAGE_OP_FUA and STORAGE_OP_SYNC writes go straight to the
+ * backend after superseding any overlapping dirty data.
  * Returns: Number of bytes written on success, negative error on failure
  */
 int storage_write(struct storage_context *ctx, u64 offset,
@@ -369,6 +1538,9 @@ int storage_write(struct storage_context *ctx, u64 offset,
  * @len: Number of bytes to read
  * @flags: Operation flags
  * @req: Request structure for async completion
+ *
+ * The request is queued on the calling CPU's software queue; no shared
+ * lock is taken on submission.
  * Returns: 0 on success (async), negative error on failure
  */
 int storage_read_async(struct storage_context *ctx, u64 offset,
@@ -383,6 +1555,12 @@ int storage_read_async(struct storage_context *ctx, u64 offset,
  * @len: Number of bytes to write
  * @flags: Operation flags
  * @req: Request structure for async completion
+ *
+ * The request is queued on the calling CPU's software queue. Async
+ * writes are never buffered by write-back and go through to the
+ * backend. While nothing is dirty, checked lock-free with
+ * storage_wb_idle(), no shared lock is taken on submission; otherwise
+ * overlapping dirty data is first superseded under the write-back lock.
  * Returns: 0 on success (async), negative error on failure
  */
 int storage_write_async(struct storage_context *ctx, u64 offset,
@@ -390,42 +1568,625 @@ int storage_write_async(struct storage_context *ctx, u64 offset,
                        struct storage_request *req);
 
 /**
- * Flush pending writes to stable storage
- * @ctx: Storage context
- * @flags: Flush options
- * Returns: 0 on success, negative error on failure
+ * Configure the number of hardware dispatch queues for a context
+ * @ctx: Storage context (must have no requests in flight)
+ * @nr_hw_queues: Requested queue count, clamped to STORAGE_MAX_HW_QUEUES
+ *
+ * Per-queue depth is storage_caps.max_queue_depth / @nr_hw_queues.
+ * CPUs are spread across queues so that each queue serves a contiguous
+ * block of CPUs.
+ * Returns: Number of queues configured, negative error on failure
  */
-int storage_flush(struct storage_context *ctx, u32 flags);
+int storage_set_hw_queues(struct storage_context *ctx, u16 nr_hw_queues);
 
 /**
- * Get storage device statistics
+ * Drain software queues into a hardware queue and dispatch to the backend
  * @ctx: Storage context
- * @stats: Statistics structure to fill
- * Returns: 0 on success, negative error on failure
+ * @hwq: Hardware queue to run
+ *
+ * Drained requests are sorted by offset and front/back merged with
+ * neighbours that pass storage_req_can_merge(), unless the context has
+ * STORAGE_CTX_NOMERGE set. Each merged run is one backend I/O; on
+ * completion the result is split back to every original request's
+ * completion callback. Each request is marked IN_FLIGHT and its timeout
+ * armed before the backend op is called, since inline completion may
+ * free it before the op returns. A vectored run needs a merge_segs array; if
+ * seg_cache cannot supply one with GFP_NOWAIT, the run is not merged.
+ * Returns: Number of backend I/Os dispatched, negative error on failure
  */
-int storage_get_stats(struct storage_context *ctx,
-                     struct storage_stats *stats);
+int storage_run_hw_queue(struct storage_context *ctx,
+                        struct storage_hw_queue *hwq);
 
 /**
- * Get storage device capabilities
+ * Allocate a request from the context's pool
  * @ctx: Storage context
- * @caps: Capabilities structure to fill
- * Returns: 0 on success, negative error on failure
+ * @gfp: Allocation flags used only if the pool must grow
+ *
+ * Steady-state allocations come from the calling CPU's magazine and do
+ * not touch the slab allocator.
+ * Returns: Zeroed request on success, NULL on failure
  */
-int storage_get_caps(struct storage_context *ctx,
-                    struct storage_caps *caps);
+struct storage_request *storage_request_alloc(struct storage_context *ctx,
+                                              gfp_t gfp);
 
 /**
- * Check interface compatibility
- * @version: Version to check
- * Returns: 0 if compatible, negative error if not
+ * Return a request to its pool
+ * @req: Request obtained from storage_request_alloc()
  */
-int storage_check_compatibility(u32 version);
+void storage_request_free(struct storage_request *req);
 
 /**
- * Set power state for device
- * @ctx: Storage context
- * @state: Power state to set
+ * Enable the block cache on a device
+ * @dev: Storage device
+ * @size_bytes: Resident capacity, split evenly across shards
+ * @block_size: Caching granularity, power of two and >= min_io_size
+ * Returns: 0 on success, negative error on failure
+ */
+int storage_cache_enable(struct storage_device *dev, u64 size_bytes,
+                        u32 block_size);
+
+/**
+ * Disable the block cache and free all cached blocks
+ * @dev: Storage device
+ */
+void storage_cache_disable(struct storage_device *dev);
+
+/**
+ * Drop cached blocks overlapping a byte range
+ * @dev: Storage device
+ * @offset: Start of range
+ * @len: Length of range
+ *
+ * Called on write, trim and erase so the cache never serves stale data.
+ * Bumps inval_seq of every shard it touches, so a read miss or
+ * readahead fetched before the write cannot insert its old data after
+ * it; see storage_cache_fill_begin().
+ */
+void storage_cache_invalidate(struct storage_device *dev, u64 offset,
+                             size_t len);
+
+/**
+ * Configure readahead on a context
+ * @ctx: Storage context
+ * @max_bytes: Window ceiling, clamped to storage_caps.max_transfer_size;
+ *             0 disables readahead
+ *
+ * Once STORAGE_RA_TRIGGER_HITS reads follow a sequential or fixed-stride
+ * pattern, storage_read() issues the next window through ops->read_async
+ * into the block cache. The window grows while readahead is consumed and
+ * shrinks when the pattern breaks. Readahead has no destination without
+ * the cache, so the device must have storage_cache_enable()d first.
+ * Returns: 0 on success, -EINVAL if the device has no block cache,
+ *          negative error on failure
+ */
+int storage_set_readahead(struct storage_context *ctx, u64 max_bytes);
+
+/**
+ * Enable write-back buffering on a device
+ * @dev: Storage device
+ * @dirty_limit: Maximum buffered bytes, 0 for STORAGE_WB_DEFAULT_LIMIT
+ * Returns: 0 on success, negative error on failure
+ */
+int storage_writeback_enable(struct storage_device *dev, u64 dirty_limit);
+
+/**
+ * Write back all dirty data and return the device to write-through
+ * @dev: Storage device
+ * Returns: 0 on success, negative error if writeback failed
+ */
+int storage_writeback_disable(struct storage_device *dev);
+
+/**
+ * Register an I/O scheduler policy
+ * @ops: Scheduler operations, name must be unique
+ *
+ * Built in: "none" (FIFO), "deadline" (per-direction expiry with write
+ * starvation protection) and "wfq" (weighted fair queuing across
+ * contexts by sched_weight).
+ * Returns: 0 on success, -EEXIST if the name is taken
+ */
+int storage_register_scheduler(struct storage_sched_ops *ops);
+
+/**
+ * Unregister an I/O scheduler policy
+ * @ops: Scheduler operations; must not be in use by any device
+ */
+void storage_unregister_scheduler(struct storage_sched_ops *ops);
+
+/**
+ * Switch a device's I/O scheduler at runtime
+ * @dev: Storage device
+ * @name: Registered scheduler name
+ *
+ * Freezes submission, drains the old policy into the new one, then
+ * resumes. In-flight backend I/O is not affected.
+ * Returns: 0 on success, -ENOENT for an unknown name
+ */
+int storage_set_scheduler(struct storage_device *dev, const char *name);
+
+/**
+ * Set a context's fair-queuing weight
+ * @ctx: Storage context
+ * @weight: Relative share, 1..1000 (default STORAGE_WFQ_DEFAULT_WEIGHT)
+ * Returns: 0 on success, -EINVAL if out of range
+ */
+int storage_set_context_weight(struct storage_context *ctx, u32 weight);
+
+/**
+ * Select the completion mode of a context
+ * @ctx: Storage context (must have no requests in flight)
+ * @flags: 0 for interrupt-driven completion, STORAGE_CTX_POLLED, or
+ *         STORAGE_CTX_POLLED | STORAGE_CTX_HYBRID
+ * Returns: 0 on success, -EOPNOTSUPP if the backend has no poll op
+ */
+int storage_set_poll_mode(struct storage_context *ctx, u32 flags);
+
+/**
+ * Reap completions on a polled context
+ * @ctx: Storage context in polled mode
+ * @max_completions: Upper bound on requests completed by this call
+ *
+ * Polls every hardware queue of the context once; completion callbacks
+ * run in the caller's context.
+ * Returns: Number of requests completed, negative error on failure
+ */
+int storage_poll(struct storage_context *ctx, unsigned int max_completions);
+
+/**
+ * Wait for one request on a polled context
+ * @ctx: Storage context in polled mode
+ * @req: Submitted request
+ *
+ * In hybrid mode first sleeps for storage_poll_sleep_ns(), then spins
+ * in storage_poll() until @req completes.
+ * Returns: Request result
+ */
+int storage_poll_wait(struct storage_context *ctx, struct storage_request *req);
+
+/**
+ * Expire timed-out requests on a hardware queue
+ * @ctx: Storage context
+ * @hwq: Hardware queue whose wheel advanced
+ *
+ * Called from the wheel tick. Requests whose slot expired before their
+ * timeout_deadline are re-armed. The rest are claimed with
+ * IN_FLIGHT -> TIMED_OUT (skipping any that just completed), unlinked
+ * under the wheel lock and passed to ops->timeout with the lock
+ * dropped. On STORAGE_TIMEOUT_DONE, or without a handler, the request
+ * is completed with -ETIMEDOUT and counted in
+ * storage_stats.timeout_errors. On STORAGE_TIMEOUT_RESET_TIMER it moves
+ * back to IN_FLIGHT and is re-armed, unless the backend completed it
+ * meanwhile (req->stashed), in which case that result is delivered
+ * instead.
+ * Returns: Number of requests expired
+ */
+int storage_expire_requests(struct storage_context *ctx,
+                           struct storage_hw_queue *hwq);
+
+/**
+ * Complete an asynchronous request
+ * @req: Request handed to the backend
+ * @result: 0 or negative error
+ * @bytes: Bytes actually transferred
+ *
+ * Called by backends from any context once the I/O has finished.
+ * Relies on req->ctx, which the core set at submission; backends never
+ * assign it. Claims the request with IN_FLIGHT -> COMPLETE; if the
+ * timeout path owns it (TIMED_OUT), the result is handed over with
+ * storage_request_stash() instead, so a request is delivered exactly
+ * once. The winner records completion
+ * time, statistics and latency, invokes req->completion and then
+ * ops->completion_notify.
+ */
+void storage_request_complete(struct storage_request *req, int result,
+                             size_t bytes);
+
+/**
+ * Complete a batch of asynchronous requests
+ * @batch: Requests with result and bytes_transferred filled in
+ *
+ * Every request must already be claimed IN_FLIGHT -> COMPLETE, as
+ * storage_completion_batch_add() does; requests the timeout path owns
+ * never enter a batch.
+ *
+ * Accounts statistics and latency for the whole batch, then delivers it
+ * to the context's batch handler (or each request's completion callback)
+ * and to ops->completion_notify_batch (or completion_notify per request).
+ * Requests may belong to different contexts; runs of the same context
+ * are delivered together. Empties @batch.
+ */
+void storage_request_complete_batch(struct storage_completion_batch *batch);
+
+/**
+ * Register a batch completion handler on a context
+ * @ctx: Storage context
+ * @fn: Handler, or NULL to restore per-request callbacks
+ * @data: Cookie passed to @fn
+ * Returns: 0 on success, -EBUSY if requests are in flight
+ */
+int storage_set_batch_completion(struct storage_context *ctx,
+                                 storage_batch_complete_fn fn, void *data);
+
+/**
+ * Enable transparent LZ4 compression on a device
+ * @dev: Storage device
+ * @chunk_size: Compression unit, 0 for STORAGE_COMPRESS_CHUNK_SIZE
+ * @nr_workers: Worker threads, 0 for one per online CPU
+ *
+ * Writes are split into chunks compressed in parallel on the worker
+ * pool; chunks failing storage_compress_probe() or not shrinking by at
+ * least one sector are stored raw. Reads decompress all chunks of a
+ * request in parallel. Sets STORAGE_FEATURE_COMPRESSION in the caps.
+ *
+ * I/O need not be chunk aligned. A write covering only part of a chunk
+ * reads the current chunk, decompresses it (or zero-fills an unmapped
+ * one), merges the new bytes and recompresses the result as a whole
+ * chunk; reads decompress each touched chunk and copy out the requested
+ * range. Offsets and lengths must still be multiples of
+ * storage_caps.min_io_size.
+ *
+ * The chunk map is loaded from the head of the backend and the sector
+ * bitmap rebuilt from it. Each chunk write stores its data first, then
+ * marks the map block dirty; storage_flush() writes dirty map blocks
+ * before flushing the backend and frees the superseded extents after.
+ * Returns: 0 on success, -EBUSY if another remapping layer is attached,
+ *          negative error on failure
+ */
+int storage_compress_enable(struct storage_device *dev, u32 chunk_size,
+                           unsigned int nr_workers);
+
+/**
+ * Enable AES-XTS encryption on a device
+ * @dev: Storage device
+ * @key: XTS key (two AES keys concatenated)
+ * @keylen: 32 or 64 bytes
+ * @data_unit_size: Bytes per tweak, 0 for STORAGE_CRYPT_DEFAULT_UNIT
+ *
+ * Once enabled, every read and write offset and length must be a
+ * multiple of data_unit_size; unaligned I/O fails with -EINVAL rather
+ * than doing a read-modify-write of the partial units. max_transfer_size
+ * is capped at STORAGE_CRYPT_MAX_IO: synchronous writes are split into
+ * pieces of that size, larger async writes fail with -EINVAL and merges
+ * stop there.
+ *
+ * Writes are encrypted in place when the caller passes
+ * STORAGE_OP_INPLACE and the buffer is 16-byte aligned, otherwise into
+ * pages from a mempool of at least STORAGE_CRYPT_POOL_PAGES. Sync writes
+ * hold the pages until ops->write/writev returns. Async writes, plain,
+ * vectored or merged, are encrypted at dispatch after merging, sent as
+ * the bounce page list through writev_async (backends without it need
+ * STORAGE_OP_INPLACE, else -EOPNOTSUPP), and the pages are freed at
+ * completion through req->crypt_segs.
+ *
+ * Reads of every kind are decrypted in place in the caller's buffer or
+ * segments after the backend fills them, for async reads at completion
+ * before req->completion runs. Every data unit goes through the per-CPU
+ * preallocated cipher request, so the per-I/O cost is a few setup stores.
+ * Returns: 0 on success, negative error on failure
+ */
+int storage_crypt_enable(struct storage_device *dev, const u8 *key,
+                        unsigned int keylen, u32 data_unit_size);
+
+/**
+ * Format a device for snapshots
+ * @dev: Storage device
+ * @meta_blocks: Metadata blocks reserved for tree nodes
+ *
+ * Writes both superblock copies with an empty live tree; data extents
+ * start after the metadata area.
+ * Returns: 0 on success, -EBUSY if another remapping layer is attached,
+ *          negative error on failure
+ */
+int storage_snap_format(struct storage_device *dev, u64 meta_blocks);
+
+/**
+ * Attach a device formatted for snapshots
+ * @dev: Storage device
+ *
+ * Loads the newest valid superblock, reads the live tree and every
+ * snapshot tree, and rebuilds extent_refs and the free bitmaps from them.
+ * Sets STORAGE_FEATURE_SNAPSHOTS in the caps.
+ * Returns: 0 on success, -EINVAL if no valid superblock is found,
+ *          -EBUSY if another remapping layer is attached
+ */
+int storage_snap_open(struct storage_device *dev);
+
+/**
+ * Create a point-in-time snapshot
+ * @dev: Storage device with snapshots enabled
+ * @name: Snapshot name
+ *
+ * O(1): takes a reference on the live root. Subsequent live writes to a
+ * shared extent copy only that extent (STORAGE_SNAP_EXTENT_SIZE) and
+ * the tree nodes on its path. The snapshot is durable after the next
+ * storage_flush() commit.
+ * Returns: Snapshot on success, ERR_PTR on failure
+ */
+struct storage_snapshot *storage_snapshot_create(struct storage_device *dev,
+                                                 const char *name);
+
+/**
+ * Delete a snapshot and release extents no other tree references
+ * @dev: Storage device
+ * @snap: Snapshot to delete; must have no open contexts
+ */
+void storage_snapshot_delete(struct storage_device *dev,
+                            struct storage_snapshot *snap);
+
+/**
+ * Open a read-only context on a snapshot
+ * @dev: Storage device
+ * @snap: Snapshot to read
+ *
+ * Reads walk the snapshot's immutable tree under rcu_read_lock() and
+ * never take the live write_lock.
+ * Returns: Context pointer on success, NULL on failure
+ */
+struct storage_context *storage_snapshot_open_context(struct storage_device *dev,
+                                                      struct storage_snapshot *snap);
+
+/**
+ * Enable discard coalescing on a device
+ * @dev: Storage device
+ * @batch_bytes: Queued bytes that force dispatch, 0 for
+ *               STORAGE_DISCARD_BATCH_BYTES
+ *
+ * Trims are queued instead of reaching ops->trim (or ops->erase when the
+ * device supports only discard) and dispatched after
+ * STORAGE_DISCARD_IDLE_MS without I/O or when @batch_bytes is queued.
+ * Requires storage_caps.supports_trim or supports_discard. Issued trims
+ * are aligned to storage_caps.min_io_size, which must be a power of two.
+ * Returns: 0 on success, -EOPNOTSUPP if the device supports neither,
+ *          -EINVAL if min_io_size is not a power of two
+ */
+int storage_discard_enable(struct storage_device *dev, u64 batch_bytes);
+
+/**
+ * Drop queued discards overlapping a range about to be written
+ * @dev: Storage device
+ * @offset: Start of written range
+ * @len: Length of written range
+ *
+ * Called on every write path; partially covered ranges are trimmed
+ * back or split.
+ */
+void storage_discard_cancel(struct storage_device *dev, u64 offset,
+                           size_t len);
+
+/**
+ * Format a thin-provisioned volume on a device
+ * @dev: Storage device
+ * @logical_size: Advertised size, may exceed the backend capacity
+ * @chunk_size: Allocation unit, 0 for STORAGE_THIN_DEFAULT_CHUNK
+ *
+ * Physical chunks are zero-filled around the first write when allocated,
+ * since a trimmed backend range is not guaranteed to read back as zeros;
+ * a chunk reused after a trim never exposes its previous owner's data.
+ * Returns: 0 on success, -EBUSY if another remapping layer is attached,
+ *          negative error on failure
+ */
+int storage_thin_format(struct storage_device *dev, u64 logical_size,
+                       u32 chunk_size);
+
+/**
+ * Attach an existing thin-provisioned volume
+ * @dev: Storage device
+ *
+ * Reads the superblock and reverse map sequentially and rebuilds the
+ * forward map in memory.
+ * Returns: 0 on success, -EINVAL if no valid superblock is found,
+ *          -EBUSY if another remapping layer is attached
+ */
+int storage_thin_open(struct storage_device *dev);
+
+/**
+ * Format a deduplicated volume on a device
+ * @dev: Storage device
+ * @logical_size: Advertised size, a multiple of STORAGE_DEDUP_BLOCK_SIZE
+ *
+ * Writes the superblock, an all-unwritten logical map and an empty
+ * fingerprint table; physical blocks fill the rest of the backend.
+ * Returns: 0 on success, -EBUSY if another remapping layer is attached,
+ *          negative error on failure
+ */
+int storage_dedup_format(struct storage_device *dev, u64 logical_size);
+
+/**
+ * Attach a deduplicated volume
+ * @dev: Storage device
+ * @expected_blocks: Unique blocks the index and Bloom filter are sized for
+ *
+ * Reads the superblock, logical map and fingerprint table, then rebuilds
+ * refcounts, free_blocks, the index and the Bloom filter (rounded up to a
+ * power of two bits).
+ *
+ * While attached, storage_write()/storage_writev() fingerprint each
+ * STORAGE_DEDUP_BLOCK_SIZE block with xxh64, consult the Bloom filter,
+ * then the index; verified duplicates only bump a refcount and update
+ * the logical map, unique blocks get a new physical block. Either way
+ * the block the logical address used to reference is released. Partial
+ * blocks are read, merged and written as a whole block.
+ * storage_read()/storage_readv() translate every block through the
+ * logical map and return zeros for unwritten blocks. Trims (discard
+ * ranges and STORAGE_REQ_TRIM) release the covered blocks and mark them
+ * unwritten in the on-disk map. The async and
+ * async vectored read and write paths fail with -EOPNOTSUPP.
+ * Returns: 0 on success, -EINVAL if no valid superblock is found,
+ *          -EBUSY if another remapping layer is attached
+ */
+int storage_dedup_open(struct storage_device *dev, u64 expected_blocks);
+
+/**
+ * Start batching async submissions on a context
+ * @ctx: Storage context
+ * @plug: Caller-provided plug, typically on the stack
+ *
+ * Until storage_unplug(), storage_read_async()/storage_write_async()
+ * called by the current task only record the request in @plug;
+ * submissions from other tasks on the same context are dispatched
+ * normally. Reaching STORAGE_PLUG_MAX_REQUESTS flushes the batch early.
+ * One task plugs a context at a time: if another task already owns the
+ * context's plug, @plug stays inactive and requests go straight out.
+ */
+void storage_plug(struct storage_context *ctx, struct storage_plug *plug);
+
+/**
+ * Dispatch all requests held by a plug and stop batching
+ * @plug: Plug started with storage_plug()
+ *
+ * Hands the batch to ops->submit_batch in runs of up to
+ * STORAGE_PLUG_SUBMIT_BATCH requests, or falls back to per-request
+ * read_async/write_async when the backend lacks it. Requests that fail
+ * to dispatch are completed with their error either way.
+ * Returns: 0 on success, negative error of the first failed dispatch
+ */
+int storage_unplug(struct storage_plug *plug);
+
+/**
+ * Dispatch all requests held by a plug but keep batching
+ * @plug: Active plug
+ * Returns: 0 on success, negative error of the first failed dispatch
+ */
+int storage_flush_plug(struct storage_plug *plug);
+
+/**
+ * Submit an array of prepared requests in one call
+ * @ctx: Storage context
+ * @reqs: Requests with offset, length, buffer, flags and type filled in
+ * @nr: Number of requests
+ *
+ * Every request is completed exactly once, including those that fail
+ * to dispatch; callers must not complete them on error.
+ * Returns: 0 on success, negative error of the first failed dispatch
+ */
+int storage_submit_batch(struct storage_context *ctx,
+                        struct storage_request **reqs, unsigned int nr);
+
+/**
+ * Synchronous vectored read
+ * @ctx: Storage context
+ * @offset: Byte offset to read from
+ * @segs: Destination segments, filled in order
+ * @nr_segs: Number of segments, at most STORAGE_MAX_SEGMENTS
+ * @flags: Operation flags
+ * Returns: Number of bytes read on success, negative error on failure
+ */
+int storage_readv(struct storage_context *ctx, u64 offset,
+                 const struct storage_segment *segs, unsigned int nr_segs,
+                 u32 flags);
+
+/**
+ * Synchronous vectored write
+ * @ctx: Storage context
+ * @offset: Byte offset to write to
+ * @segs: Source segments, written in order
+ * @nr_segs: Number of segments, at most STORAGE_MAX_SEGMENTS
+ * @flags: Operation flags
+ *
+ * Under write-back the segments are gathered into the dirty extents
+ * like storage_write(); FUA/SYNC writes, storage_writev_async() and
+ * storage_write_async() write through after superseding dirty data.
+ * Returns: Number of bytes written on success, negative error on failure
+ */
+int storage_writev(struct storage_context *ctx, u64 offset,
+                  const struct storage_segment *segs, unsigned int nr_segs,
+                  u32 flags);
+
+/**
+ * Asynchronous vectored read
+ * @ctx: Storage context
+ * @offset: Byte offset to read from
+ * @segs: Destination segments; must stay valid until completion
+ * @nr_segs: Number of segments, at most STORAGE_MAX_SEGMENTS
+ * @flags: Operation flags
+ * @req: Request structure for async completion
+ *
+ * A single segment is sent through ops->read_async if the backend has no
+ * readv_async; more than one segment is rejected rather than split.
+ * Returns: 0 on success (async), -EOPNOTSUPP if the backend cannot take
+ * the segment list, negative error on failure
+ */
+int storage_readv_async(struct storage_context *ctx, u64 offset,
+                       const struct storage_segment *segs,
+                       unsigned int nr_segs, u32 flags,
+                       struct storage_request *req);
+
+/**
+ * Asynchronous vectored write
+ * @ctx: Storage context
+ * @offset: Byte offset to write to
+ * @segs: Source segments; must stay valid until completion
+ * @nr_segs: Number of segments, at most STORAGE_MAX_SEGMENTS
+ * @flags: Operation flags
+ * @req: Request structure for async completion
+ *
+ * A single segment is sent through ops->write_async if the backend has no
+ * writev_async; more than one segment is rejected rather than split.
+ * Returns: 0 on success (async), -EOPNOTSUPP if the backend cannot take
+ * the segment list, negative error on failure
+ */
+int storage_writev_async(struct storage_context *ctx, u64 offset,
+                        const struct storage_segment *segs,
+                        unsigned int nr_segs, u32 flags,
+                        struct storage_request *req);
+
+/**
+ * Flush pending writes to stable storage
+ * @ctx: Storage context
+ * @flags: Flush options
+ *
+ * Writes back every dirty extent, then calls ops->flush, so all data
+ * accepted before the call is durable when it returns.
+ * Returns: 0 on success, negative error on failure
+ */
+int storage_flush(struct storage_context *ctx, u32 flags);
+
+/**
+ * Get storage device statistics
+ * @ctx: Storage context
+ * @stats: Statistics structure to fill
+ *
+ * Sums global_stats and every per-CPU shard, retrying a shard whose
+ * seqcount changed while it was being copied, so each shard contributes
+ * a snapshot taken between two updates.
+ * Returns: 0 on success, negative error on failure
+ */
+int storage_get_stats(struct storage_context *ctx,
+                     struct storage_stats *stats);
+
+/**
+ * Get latency percentiles for one request type
+ * @ctx: Storage context
+ * @type: STORAGE_REQ_READ, STORAGE_REQ_WRITE, STORAGE_REQ_FLUSH or
+ *        STORAGE_REQ_TRIM
+ * @summary: Summary structure to fill
+ *
+ * Merges the per-CPU histograms of the device and walks the result once.
+ * Returns: 0 on success, -EINVAL for an unknown type
+ */
+int storage_get_latency_histogram(struct storage_context *ctx, int type,
+                                 struct storage_latency_summary *summary);
+
+/**
+ * Get storage device capabilities
+ * @ctx: Storage context
+ * @caps: Capabilities structure to fill
+ * Returns: 0 on success, negative error on failure
+ */
+int storage_get_caps(struct storage_context *ctx,
+                    struct storage_caps *caps);
+
+/**
+ * Check interface compatibility
+ * @version: Version to check
+ * Returns: 0 if compatible, negative error if not
+ */
+int storage_check_compatibility(u32 version);
+
+/**
+ * Set power state for device
+ * @ctx: Storage context
+ * @state: Power state to set
  * Returns: 0 on success, negative error on failure
  */
 int storage_set_power_state(struct storage_context *ctx, u32 state);
@@ -449,6 +2210,66 @@ int storage_get_last_error(struct storage_context *ctx,
     extern const struct storage_ops __storage_backend_##name; \
     const char *__storage_backend_##name##_desc = desc;
 
+/**
+ * Helper for copying sectors while generating protection information
+ * Each sector is checksummed from @dst right after it is copied, while
+ * it is still in L1, so integrity costs no extra pass through memory.
+ * Use at the copy points the stack already has (cache, write-back,
+ * bounce buffers, RAM backends); @len must be a multiple of @sector_size.
+ */
+static inline void storage_pi_copy_generate(void *dst, const void *src,
+                                            size_t len, u32 sector_size,
+                                            u64 offset,
+                                            struct storage_pi_tuple *pi) {
+    u64 sector = div_u64(offset, sector_size);
+    size_t done;
+
+    for (done = 0; done < len; done += sector_size, sector++, pi++) {
+        memcpy(dst + done, src + done, sector_size);
+        pi->crc = cpu_to_le32(crc32c(~0U, dst + done, sector_size));
+        pi->ref_tag = cpu_to_le32(lower_32_bits(sector));
+    }
+}
+
+/**
+ * Helper for copying sectors while verifying protection information
+ * On mismatch, fills @err with the failing sector's offset and stops.
+ * Returns: 0 if every sector matched, -EBADMSG on the first mismatch
+ */
+static inline int storage_pi_copy_verify(void *dst, const void *src,
+                                         size_t len, u32 sector_size,
+                                         u64 offset,
+                                         const struct storage_pi_tuple *pi,
+                                         struct error_info *err) {
+    u64 sector = div_u64(offset, sector_size);
+    size_t done;
+
+    for (done = 0; done < len; done += sector_size, sector++, pi++) {
+        const char *details = NULL;
+
+        memcpy(dst + done, src + done, sector_size);
+        if (le32_to_cpu(pi->ref_tag) != lower_32_bits(sector))
+            details = "Reference tag mismatch (misdirected I/O)";
+        else if (le32_to_cpu(pi->crc) != crc32c(~0U, dst + done, sector_size))
+            details = "CRC32C mismatch";
+
+        if (details) {
+            memset(err, 0, sizeof(*err));
+            err->error_code = -EBADMSG;
+            err->timestamp = ktime_get_ns();
+            err->operation = "pi_verify";
+            err->offset = offset + done;
+            err->length = sector_size;
+            err->details = details;
+            err->recovery_hint = "Retry the read or restore the sector from a replica";
+            err->is_recoverable = true;
+            return -EBADMSG;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * Helper for validating storage context
  * Returns true if valid, false if corrupted
@@ -465,6 +2286,35 @@ static inline struct storage_device *storage_get_device(struct storage_context *
     return storage_context_is_valid(ctx) ? ctx->device : NULL;
 }
 
+/**
+ * Helper for taking an I/O reference on a context at submission
+ * Returns false once the context is closing
+ */
+static inline bool storage_context_io_get(struct storage_context *ctx) {
+    return percpu_ref_tryget_live(&ctx->io_ref);
+}
+
+/**
+ * Helper for dropping an I/O reference at completion
+ */
+static inline void storage_context_io_put(struct storage_context *ctx) {
+    percpu_ref_put(&ctx->io_ref);
+}
+
+/**
+ * Helper for iterating a device's contexts without taking contexts_lock
+ * Caller must hold rcu_read_lock()
+ */
+#define storage_for_each_context_rcu(ctx, dev) \
+    list_for_each_entry_rcu(ctx, &(dev)->contexts, list)
+
+/**
+ * Helper for testing a version 3 optional op
+ * Usage: if (STORAGE_OPS_HAS_V3(ops, submit_batch)) ...
+ */
+#define STORAGE_OPS_HAS_V3(ops, op) \
+    ((ops)->version >= 3 && (ops)->op)
+
 /**
  * Helper for checking if operation is supported
  */
@@ -474,4 +2324,631 @@ static inline bool storage_op_supported(struct storage_context *ctx,
     return dev && dev->ops && dev->ops->version >= STORAGE_MODULE_MIN_VERSION;
 }
 
+/**
+ * Helper for queueing a request on the current CPU's software queue
+ * Lock-free: llist_add() is a single cmpxchg on a CPU-local cache line.
+ * Returns true if the queue was empty and the hardware queue must be kicked.
+ */
+static inline bool storage_sw_queue_add(struct storage_context *ctx,
+                                        struct storage_request *req) {
+    struct storage_sw_queue *swq = get_cpu_ptr(ctx->sw_queues);
+    bool first;
+
+    req->hw_queue = swq->hw_queue;
+    swq->nr_submitted++;
+    first = llist_add(&req->sw_node, &swq->submitted);
+    put_cpu_ptr(ctx->sw_queues);
+
+    return first;
+}
+
+/**
+ * Helper for recording a completed read in the local statistics shard
+ */
+static inline void storage_stats_account_read(struct storage_device *dev,
+                                              size_t bytes) {
+    struct storage_stats_shard *shard;
+    unsigned long irqflags;
+
+    local_irq_save(irqflags);
+    shard = this_cpu_ptr(dev->stats_shards);
+    write_seqcount_begin(&shard->seq);
+    shard->stats.reads_completed++;
+    shard->stats.bytes_read += bytes;
+    write_seqcount_end(&shard->seq);
+    local_irq_restore(irqflags);
+}
+
+/**
+ * Helper for recording a completed write in the local statistics shard
+ */
+static inline void storage_stats_account_write(struct storage_device *dev,
+                                               size_t bytes) {
+    struct storage_stats_shard *shard;
+    unsigned long irqflags;
+
+    local_irq_save(irqflags);
+    shard = this_cpu_ptr(dev->stats_shards);
+    write_seqcount_begin(&shard->seq);
+    shard->stats.writes_completed++;
+    shard->stats.bytes_written += bytes;
+    write_seqcount_end(&shard->seq);
+    local_irq_restore(irqflags);
+}
+
+/**
+ * Helper for taking a consistent copy of one statistics shard
+ */
+static inline void storage_stats_shard_read(const struct storage_stats_shard *shard,
+                                            struct storage_stats *out) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&shard->seq);
+        *out = shard->stats;
+    } while (read_seqcount_retry(&shard->seq, seq));
+}
+
+/**
+ * Helper for mapping a latency in nanoseconds to its histogram bucket
+ */
+static inline unsigned int storage_lat_bucket(u64 ns) {
+    unsigned int shift;
+
+    if (ns < (1ULL << STORAGE_LAT_SUB_BITS))
+        return ns;
+    if (ns >= (1ULL << STORAGE_LAT_MAX_SHIFT))
+        return STORAGE_LAT_NR_BUCKETS - 1;
+
+    shift = fls64(ns) - 1 - STORAGE_LAT_SUB_BITS;
+    return ((shift + 1) << STORAGE_LAT_SUB_BITS) +
+           ((ns >> shift) & ((1U << STORAGE_LAT_SUB_BITS) - 1));
+}
+
+/**
+ * Helper for recording a finished request's latency
+ * One per-CPU increment plus a rarely-taken max update. Both are single
+ * this_cpu operations, so a completion interrupting another on the same
+ * CPU cannot lose a count or a new maximum.
+ */
+static inline void storage_lat_record(struct storage_device *dev,
+                                      const struct storage_request *req) {
+    u64 ns = req->completion_time_ns - req->start_time_ns;
+    u64 old, cur;
+
+    this_cpu_inc(dev->lat_hist->buckets[req->type][storage_lat_bucket(ns)]);
+
+    old = this_cpu_read(dev->lat_hist->max_ns[req->type]);
+    while (unlikely(ns > old)) {
+        cur = this_cpu_cmpxchg(dev->lat_hist->max_ns[req->type], old, ns);
+        if (cur == old)
+            break;
+        old = cur;
+    }
+}
+
+/**
+ * Helper for picking the cache shard that owns a block
+ */
+static inline struct storage_cache_shard *
+storage_cache_shard(struct storage_cache *cache, u64 block) {
+    return &cache->shards[hash_64(block, STORAGE_CACHE_SHARD_BITS)];
+}
+
+/**
+ * Helper for sampling a shard before fetching a block from the backend
+ * Read misses and readahead call this per block before issuing the I/O.
+ * Returns the sequence to hand to storage_cache_fill_valid()
+ */
+static inline u64 storage_cache_fill_begin(struct storage_cache_shard *shard) {
+    return READ_ONCE(shard->inval_seq);
+}
+
+/**
+ * Helper for checking that fetched data may still be inserted
+ * Caller holds shard->lock. Returns false if an invalidation ran since
+ * @seq was sampled; the data may predate a write and must be dropped.
+ */
+static inline bool storage_cache_fill_valid(const struct storage_cache_shard *shard,
+                                            u64 seq) {
+    return shard->inval_seq == seq;
+}
+
+/**
+ * Helper for checking whether a read may use the cache
+ */
+static inline bool storage_cache_usable(const struct storage_device *dev,
+                                        u32 flags) {
+    return dev->cache && !(flags & STORAGE_OP_NOCACHE);
+}
+
+/**
+ * Helper for feeding one read into the stream detector
+ * Returns true if the read continues the detected stream
+ */
+static inline bool storage_ra_update(struct storage_readahead *ra,
+                                     u64 offset, size_t len) {
+    s64 stride = (s64)offset - (s64)(ra->last_offset + ra->last_len);
+    bool match = stride == ra->stride;
+
+    if (match)
+        ra->matches++;
+    else
+        ra->matches = 0;
+
+    ra->stride = stride;
+    ra->last_offset = offset;
+    ra->last_len = len;
+
+    return match;
+}
+
+/**
+ * Helper for checking whether a through write can skip the write-back lock
+ * Lock-free fast path: nothing dirty means nothing to supersede.
+ */
+static inline bool storage_wb_idle(const struct storage_device *dev) {
+    return !dev->writeback || !READ_ONCE(dev->writeback->dirty_bytes);
+}
+
+/**
+ * Helper for checking whether a write must bypass the write-back buffer
+ * Async writes always bypass it; the caller still supersedes dirty data.
+ */
+static inline bool storage_write_is_through(const struct storage_device *dev,
+                                            u32 flags, bool async) {
+    return !dev->writeback || async ||
+           (flags & (STORAGE_OP_FUA | STORAGE_OP_SYNC));
+}
+
+/**
+ * Helper for computing the total length of a segment array
+ */
+static inline size_t storage_segments_len(const struct storage_segment *segs,
+                                          unsigned int nr_segs) {
+    size_t len = 0;
+    unsigned int i;
+
+    for (i = 0; i < nr_segs; i++)
+        len += segs[i].len;
+
+    return len;
+}
+
+/**
+ * Helper for the number of segments a request contributes to a merge
+ * A plain request is one segment; a merge head counts its merge_segs.
+ */
+static inline unsigned int storage_req_nr_segs(const struct storage_request *req) {
+    return req->nr_segs ? req->nr_segs : 1;
+}
+
+/**
+ * Helper for checking whether @next can be back-merged onto @prev
+ * Requests merge when they come from the same context (a scheduler may
+ * dispatch several contexts' requests on one queue, and the merged I/O
+ * is charged to the head's context), are the same type with the same
+ * flags, carry no protection information (req->pi only covers the request's
+ * own sectors), are contiguous on the device, and the result stays
+ * within @max_len
+ * (storage_caps.max_transfer_size). With @vectored (backend has
+ * readv_async/writev_async) the merged I/O is sent as a segment list of
+ * at most STORAGE_MAX_SEGMENTS; otherwise the buffers must also be
+ * contiguous in memory.
+ */
+static inline bool storage_req_can_merge(const struct storage_request *prev,
+                                         const struct storage_request *next,
+                                         u64 max_len, bool vectored) {
+    if (prev->ctx != next->ctx ||
+        prev->type != next->type || prev->flags != next->flags ||
+        (prev->flags & STORAGE_OP_FUA) || prev->pi || next->pi ||
+        prev->offset + prev->length != next->offset ||
+        prev->length + next->length > max_len)
+        return false;
+
+    if (vectored)
+        return storage_req_nr_segs(prev) + storage_req_nr_segs(next) <=
+               STORAGE_MAX_SEGMENTS;
+
+    return !prev->nr_segs && !next->nr_segs &&
+           (const u8 *)prev->buffer + prev->length == next->buffer;
+}
+
+/**
+ * Helper for folding a completed request into the context's mean
+ * service time (EWMA, weight 1/2^STORAGE_POLL_EWMA_SHIFT)
+ */
+static inline void storage_poll_update_mean(struct storage_context *ctx,
+                                            const struct storage_request *req) {
+    u64 ns = req->completion_time_ns - req->start_time_ns;
+    u64 mean = READ_ONCE(ctx->poll_mean_ns);
+
+    if (!mean)
+        mean = ns;
+    else
+        mean = mean - (mean >> STORAGE_POLL_EWMA_SHIFT) +
+               (ns >> STORAGE_POLL_EWMA_SHIFT);
+    WRITE_ONCE(ctx->poll_mean_ns, mean);
+}
+
+/**
+ * Helper for the hybrid poll sleep before spinning
+ * Returns 0 when no estimate exists yet or the context is not hybrid
+ */
+static inline u64 storage_poll_sleep_ns(const struct storage_context *ctx) {
+    if (!(ctx->flags & STORAGE_CTX_HYBRID))
+        return 0;
+
+    return READ_ONCE(ctx->poll_mean_ns) / STORAGE_POLL_SLEEP_DIV;
+}
+
+/**
+ * Helper for moving a request between ownership states
+ * Returns true if the request was in @from and is now in @to
+ */
+static inline bool storage_request_claim(struct storage_request *req,
+                                         enum storage_req_state from,
+                                         enum storage_req_state to) {
+    return atomic_cmpxchg(&req->state, from, to) == from;
+}
+
+/**
+ * Helper for handing a late backend result to the timeout path
+ * Used when the request is TIMED_OUT; storage_expire_requests() reads
+ * the stash after ops->timeout returns.
+ */
+static inline void storage_request_stash(struct storage_request *req,
+                                         int result, size_t bytes) {
+    req->stash_result = result;
+    req->stash_bytes = bytes;
+    smp_store_release(&req->stashed, true);
+}
+
+/**
+ * Helper for adding a finished request to a completion batch
+ * Claims the request first; one owned by the timeout path gets the
+ * result stashed instead and is left out. Flushes the batch to the core
+ * when it is full.
+ */
+static inline void storage_completion_batch_add(struct storage_completion_batch *batch,
+                                                struct storage_request *req,
+                                                int result, size_t bytes) {
+    if (!storage_request_claim(req, STORAGE_REQ_IN_FLIGHT,
+                               STORAGE_REQ_COMPLETE)) {
+        storage_request_stash(req, result, bytes);
+        return;
+    }
+
+    req->result = result;
+    req->bytes_transferred = bytes;
+    batch->reqs[batch->nr++] = req;
+
+    if (batch->nr == STORAGE_COMPLETION_BATCH)
+        storage_request_complete_batch(batch);
+}
+
+/**
+ * Helper for picking the wheel level that holds an expiry
+ */
+static inline unsigned int storage_tw_level(u64 clock, u64 expires) {
+    u64 delta = expires > clock ? expires - clock : 0;
+    unsigned int level = 0;
+
+    while (level < STORAGE_TW_LEVELS - 1 &&
+           delta >= (1ULL << (STORAGE_TW_SLOT_BITS * (level + 1))))
+        level++;
+
+    return level;
+}
+
+/**
+ * Helper for arming a request's timeout on a wheel
+ * Caller holds wheel->lock; dispatch arms a whole batch under one hold.
+ * Must run before the request is handed to the backend op: backends may
+ * complete, and the core free, the request before the op returns.
+ * Timeouts beyond the wheel's range are parked in the farthest slot and
+ * re-armed on expiry until timeout_deadline is reached.
+ */
+static inline void storage_tw_arm(struct storage_timer_wheel *wheel,
+                                  struct storage_request *req,
+                                  u32 timeout_ms) {
+    unsigned int level;
+    unsigned int slot;
+
+    req->timeout_deadline = wheel->clock +
+                            DIV_ROUND_UP(timeout_ms, STORAGE_TW_TICK_MS);
+    req->timeout_expires = min_t(u64, req->timeout_deadline,
+                                 wheel->clock + STORAGE_TW_MAX_TICKS);
+    level = storage_tw_level(wheel->clock, req->timeout_expires);
+    slot = (req->timeout_expires >> (STORAGE_TW_SLOT_BITS * level)) &
+           STORAGE_TW_SLOT_MASK;
+
+    hlist_add_head(&req->timeout_node, &wheel->slots[level][slot]);
+    wheel->nr_armed++;
+}
+
+/**
+ * Helper for cancelling a request's timeout
+ * Caller holds wheel->lock; no-op if the request already expired.
+ */
+static inline void storage_tw_cancel(struct storage_timer_wheel *wheel,
+                                     struct storage_request *req) {
+    if (hlist_unhashed(&req->timeout_node))
+        return;
+
+    hlist_del_init(&req->timeout_node);
+    wheel->nr_armed--;
+}
+
+/**
+ * Helper for a cheap entropy probe before compressing a chunk
+ * Samples STORAGE_COMPRESS_PROBE_SAMPLES bytes at a fixed stride and
+ * counts distinct values; near-uniform data (already compressed or
+ * encrypted) is not worth an LZ4 pass.
+ * Returns true if the chunk looks compressible
+ */
+static inline bool storage_compress_probe(const u8 *buf, size_t len) {
+    DECLARE_BITMAP(seen, 256);
+    size_t stride = max_t(size_t, len / STORAGE_COMPRESS_PROBE_SAMPLES, 1);
+    unsigned int distinct = 0;
+    size_t i;
+
+    bitmap_zero(seen, 256);
+    for (i = 0; i < len; i += stride) {
+        if (!__test_and_set_bit(buf[i], seen))
+            distinct++;
+    }
+
+    return distinct <= STORAGE_COMPRESS_PROBE_MAX;
+}
+
+/**
+ * Helper for packing a chunk map entry
+ */
+static inline u64 storage_cmap_pack(u64 sector, u32 sectors, bool raw) {
+    return (sector & STORAGE_CMAP_SECTOR_MASK) |
+           ((u64)(sectors & STORAGE_CMAP_LEN_MASK) << STORAGE_CMAP_LEN_SHIFT) |
+           (raw ? STORAGE_CMAP_RAW : 0);
+}
+
+/**
+ * Helper for the stored length of a chunk map entry, in sectors
+ */
+static inline u32 storage_cmap_sectors(u64 entry) {
+    return (entry >> STORAGE_CMAP_LEN_SHIFT) & STORAGE_CMAP_LEN_MASK;
+}
+
+/**
+ * Helper for building the XTS tweak of a data unit
+ */
+static inline void storage_crypt_iv(const struct storage_crypt *crypt,
+                                    u64 offset, u8 iv[16]) {
+    __le64 unit = cpu_to_le64(offset >> crypt->data_unit_shift);
+
+    memset(iv, 0, 16);
+    memcpy(iv, &unit, sizeof(unit));
+}
+
+/**
+ * Helper for checking that an I/O covers whole data units
+ */
+static inline bool storage_crypt_aligned(const struct storage_crypt *crypt,
+                                         u64 offset, size_t len) {
+    u64 mask = crypt->data_unit_size - 1;
+
+    return !((offset | len) & mask);
+}
+
+/**
+ * Helper for checking whether a write can be encrypted in place
+ */
+static inline bool storage_crypt_inplace(const struct storage_crypt *crypt,
+                                         u64 offset, const void *buf,
+                                         size_t len, u32 flags) {
+    return (flags & STORAGE_OP_INPLACE) &&
+           storage_crypt_aligned(crypt, offset, len) &&
+           IS_ALIGNED((unsigned long)buf, 16);
+}
+
+/**
+ * Helper for resolving a byte offset in a snapshot tree
+ * Caller holds rcu_read_lock(). Returns the physical extent number + 1,
+ * or 0 if the extent was never written or lies beyond what a tree of
+ * @height levels covers.
+ */
+static inline u64 storage_snap_lookup(struct storage_snap_node *root,
+                                      u8 height, u64 offset) {
+    u64 extent = offset >> STORAGE_SNAP_EXTENT_SHIFT;
+    struct storage_snap_node *node = root;
+    unsigned int shift = height * STORAGE_SNAP_FANOUT_BITS;
+
+    /* Past the tree's reach: the top-level index would be masked off */
+    if (shift < 64 && (extent >> shift))
+        return 0;
+
+    while (node && shift) {
+        shift -= STORAGE_SNAP_FANOUT_BITS;
+        if (!shift)
+            return READ_ONCE(node->extents[extent & (STORAGE_SNAP_FANOUT - 1)]);
+        node = rcu_dereference(node->children[(extent >> shift) &
+                                              (STORAGE_SNAP_FANOUT - 1)]);
+    }
+
+    return 0;
+}
+
+/**
+ * Helper for the aligned part of a discard range
+ * Shrinks [*start, *end) inward to multiples of @granularity, a power
+ * of two checked by storage_discard_enable().
+ * Returns false if nothing aligned remains.
+ */
+static inline bool storage_discard_align(u64 *start, u64 *end, u32 granularity) {
+    u64 s = round_up(*start, granularity);
+    u64 e = round_down(*end, granularity);
+
+    if (s >= e)
+        return false;
+
+    *start = s;
+    *end = e;
+    return true;
+}
+
+/**
+ * Helper for checking whether a write can skip the discard queue
+ * Lock-free fast path: no queued ranges means nothing to cancel.
+ */
+static inline bool storage_discard_idle(struct storage_device *dev) {
+    return !dev->discards || !READ_ONCE(dev->discards->pending_bytes);
+}
+
+/**
+ * Helper for checking whether a remapping layer owns the backend layout
+ * Compression, snapshots, thin provisioning and deduplication each keep
+ * metadata at fixed backend offsets, so only one may be attached.
+ */
+static inline bool storage_remap_attached(const struct storage_device *dev) {
+    return dev->compress || dev->snaps || dev->thin || dev->dedup;
+}
+
+/**
+ * Helper for translating a logical offset on a thin volume
+ * Lock-free; caller holds rcu_read_lock() or tolerates a stale miss.
+ * Returns the backend byte offset, or U64_MAX if the chunk is unmapped
+ * and reads must return zeros.
+ */
+static inline u64 storage_thin_map(struct storage_thin *thin, u64 offset) {
+    void *entry = xa_load(&thin->map, offset >> thin->chunk_shift);
+
+    if (!entry)
+        return U64_MAX;
+
+    return thin->data_start +
+           ((u64)xa_to_value(entry) << thin->chunk_shift) +
+           (offset & (thin->chunk_size - 1));
+}
+
+/**
+ * Helper for fingerprinting one dedup block
+ */
+static inline u64 storage_dedup_fingerprint(const void *block, u32 len) {
+    return xxh64(block, len, 0);
+}
+
+/**
+ * Helper for the i-th Bloom filter bit of a fingerprint
+ * Double hashing (h1 + i * h2) derives all probes from one hash.
+ */
+static inline u64 storage_dedup_bloom_bit(const struct storage_dedup *dedup,
+                                          u64 fp, unsigned int i) {
+    u32 h1 = lower_32_bits(fp);
+    u32 h2 = upper_32_bits(fp) | 1;
+
+    return ((u64)h1 + (u64)i * h2) & dedup->bloom_mask;
+}
+
+/**
+ * Helper for testing whether a fingerprint may be in the index
+ * Lock-free; false means the block is certainly new.
+ */
+static inline bool storage_dedup_maybe_present(const struct storage_dedup *dedup,
+                                               u64 fp) {
+    unsigned int i;
+
+    for (i = 0; i < STORAGE_DEDUP_BLOOM_HASHES; i++) {
+        if (!test_bit(storage_dedup_bloom_bit(dedup, fp, i), dedup->bloom))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Helper for picking the index shard of a fingerprint
+ */
+static inline struct storage_dedup_shard *
+storage_dedup_shard(struct storage_dedup *dedup, u64 fp) {
+    return &dedup->shards[fp >> (64 - STORAGE_DEDUP_SHARD_BITS)];
+}
+
+/**
+ * Helper for the magazine fast path of storage_request_alloc()
+ * Returns a cached request, or NULL if the magazine is empty
+ */
+static inline struct storage_request *
+storage_req_magazine_pop(struct storage_req_pool *pool) {
+    struct storage_req_magazine *mag;
+    struct storage_request *req = NULL;
+    unsigned long irqflags;
+
+    local_lock_irqsave(&pool->magazines->lock, irqflags);
+    mag = this_cpu_ptr(pool->magazines);
+    if (mag->nr) {
+        req = mag->objs[--mag->nr];
+        mag->hits++;
+    } else {
+        mag->misses++;
+    }
+    local_unlock_irqrestore(&pool->magazines->lock, irqflags);
+
+    return req;
+}
+
+/**
+ * Helper for the magazine fast path of storage_request_free()
+ * Returns false if the magazine is full and the request must go to the depot
+ */
+static inline bool storage_req_magazine_push(struct storage_req_pool *pool,
+                                             struct storage_request *req) {
+    struct storage_req_magazine *mag;
+    unsigned long irqflags;
+    bool cached;
+
+    local_lock_irqsave(&pool->magazines->lock, irqflags);
+    mag = this_cpu_ptr(pool->magazines);
+    cached = mag->nr < STORAGE_REQ_MAGAZINE_SIZE;
+    if (cached)
+        mag->objs[mag->nr++] = req;
+    local_unlock_irqrestore(&pool->magazines->lock, irqflags);
+
+    return cached;
+}
+
+/**
+ * Helper for holding a request on the current task's plug
+ * Only the owning task dereferences ctx->plug, so another task's plug
+ * may be unwound from its stack at any time without harm.
+ * Returns 1 if the request was plugged, 0 if it must be dispatched, or
+ * the negative error of an early flush, in which case @req is not held
+ */
+static inline int storage_plug_add(struct storage_context *ctx,
+                                   struct storage_request *req) {
+    struct storage_plug *plug;
+    int ret;
+
+    if (READ_ONCE(ctx->plug_owner) != current)
+        return 0;
+
+    plug = ctx->plug;
+    if (plug->nr_requests == STORAGE_PLUG_MAX_REQUESTS) {
+        ret = storage_flush_plug(plug);
+        if (ret)
+            return ret;
+    }
+
+    list_add_tail(&req->list, &plug->requests);
+    plug->nr_requests++;
+    return 1;
+}
+
+/**
+ * Helper for getting the hardware queue a request was mapped to
+ */
+static inline struct storage_hw_queue *
+storage_request_hw_queue(struct storage_context *ctx,
+                         const struct storage_request *req) {
+    return &ctx->hw_queues[req->hw_queue];
+}
+
 #endif /* MODULE_INTERFACE_H */
\ No newline at end of file